@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace orchard
+{
+    // Size of the SDRAM on the Daisy Seed.
+    constexpr size_t kSdramSize{64 * 1024 * 1024};
+
+    // Bump allocator over a fixed memory region. Buffers are only allocated
+    // at init and never freed one by one, Reset releases all of them at once.
+    class Arena
+    {
+    public:
+        Arena() {}
+        ~Arena() {}
+
+        void Init(void *memory, size_t size)
+        {
+            memory_ = static_cast<uint8_t *>(memory);
+            size_ = size;
+            used_ = 0;
+            failed_ = false;
+        }
+
+        // Returns zeroed memory for count elements of T, or nullptr if the
+        // arena is full. A failed allocation is remembered, see Failed.
+        template <typename T>
+        T *Allocate(size_t count)
+        {
+            const size_t align{alignof(T) > kAlignment ? alignof(T) : kAlignment};
+            const size_t start{(used_ + align - 1) & ~(align - 1)};
+            const size_t bytes{count * sizeof(T)};
+            if (start > size_ || bytes > size_ - start)
+            {
+                failed_ = true;
+
+                return nullptr;
+            }
+            used_ = start + bytes;
+            uint8_t *memory{memory_ + start};
+            for (size_t i = 0; i < bytes; i++)
+            {
+                memory[i] = 0;
+            }
+
+            return reinterpret_cast<T *>(memory);
+        }
+
+        // Constructs a T in the arena.
+        template <typename T>
+        T *New()
+        {
+            void *memory{Allocate<T>(1)};
+
+            return memory ? new (memory) T() : nullptr;
+        }
+
+        void Reset()
+        {
+            used_ = 0;
+            failed_ = false;
+        }
+
+        size_t Used() const
+        {
+            return used_;
+        }
+
+        size_t Size() const
+        {
+            return size_;
+        }
+
+        bool Failed() const
+        {
+            return failed_;
+        }
+
+    private:
+        // Cache line size of the M7.
+        static constexpr size_t kAlignment{32};
+
+        uint8_t *memory_{nullptr};
+        size_t size_{0};
+        size_t used_{0};
+        bool failed_{false};
+    };
+}
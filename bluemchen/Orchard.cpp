@@ -1,11 +1,17 @@
 #include <time.h>
 #include "kxmx_bluemchen.h"
 
-#include "Dynamics/balance.h"
-
+#include "../arena.h"
 #include "../commons.h"
+#include "../controls.h"
+#include "../denormals.h"
 #include "../generatorbank.h"
 #include "../effectbank.h"
+#include "../limiter.h"
+#include "../modulation.h"
+#include "../patch.h"
+#include "../profiler.h"
+#include "../quantizer.h"
 
 
 using namespace kxmx;
@@ -15,25 +21,43 @@ using namespace orchard;
 
 Bluemchen bluemchen;
 
-Parameter knob1;
-Parameter knob2;
-
-Parameter knob1_dac;
-Parameter knob2_dac;
-
-Parameter cv1;
-Parameter cv2;
-
-float knob1Value;
-float knob2Value;
-
-
-Balance balancer;
+// The controls are scanned once per millisecond in the main loop, and only
+// their changes reach the pitch and the DAC.
+Hysteresis knob1;
+Hysteresis knob2;
+SchmittTrigger cv1;
+Hysteresis cv2;
+// The gate as last scanned, the audio callback clocks the delay with it.
+volatile bool gateHigh{false};
+// Scale, root and pitch as last set, the audio callback passes them to the
+// generator bank at the start of a block: the quantizer tables and the pitch
+// ramps are only touched by the callback.
+volatile int scaleIndex{static_cast<int>(kDefaultScale)};
+volatile int rootIndex{0};
+volatile float pitch{24.f};
+// Source of each modulation target as set in the menu, the audio callback
+// routes the matrix with them.
+volatile int modRoutes[kModTargets]{};
+uint32_t lastControlTick;
+bool cvPitchModulates{false};
+
+
+Limiter limiter;
 
 float sampleRate;
 
+// Buffers of the effects, see EffectBank::Init.
+alignas(32) uint8_t DSY_SDRAM_BSS sdramMemory[kSdramSize];
+Arena sdram;
+
 GeneratorBank generatorBank;
 EffectBank effectBank;
+// ReverbSc or the cheaper diffuser reverb, see EffectBank::Init.
+constexpr ReverbType kReverbType{ReverbType::SC};
+// Patches made in the main loop, applied by the audio callback.
+Mailbox<Patch> patches;
+// Routes set in the menu, knob 1 and CV 2 are sampled by the audio callback.
+ModMatrix modMatrix;
 
 daisy::UI ui;
 
@@ -42,9 +66,11 @@ FullScreenItemMenu randomizerMenu;
 FullScreenItemMenu polyEditMenu;
 FullScreenItemMenu boolEditMenu;
 FullScreenItemMenu normEditMenu;
+FullScreenItemMenu profilerMenu;
+FullScreenItemMenu modMenu;
 UiEventQueue eventQueue;
 
-const int kNumMainMenuItems = 4;
+const int kNumMainMenuItems = 5;
 AbstractMenu::ItemConfig mainMenuItems[kNumMainMenuItems];
 const int kNumRandomizerMenuItems = 4;
 AbstractMenu::ItemConfig randomizerMenuItems[kNumRandomizerMenuItems];
@@ -52,6 +78,90 @@ const int kNumPolyEditMenuItems = 4;
 AbstractMenu::ItemConfig polyEditMenuItems[kNumPolyEditMenuItems];
 const int kNumNormEditMenuItems = 4;
 AbstractMenu::ItemConfig normEditMenuItems[kNumNormEditMenuItems];
+const int kNumModMenuItems = kModTargets + 1;
+AbstractMenu::ItemConfig modMenuItems[kNumModMenuItems];
+const int kNumProfilerMenuItems = kStages + 2;
+AbstractMenu::ItemConfig profilerMenuItems[kNumProfilerMenuItems];
+
+// Shows the load of a processing stage as a percentage of the block budget.
+// Turning the encoder while editing cycles through min, mean, max and p99,
+// "zz" follows the name of a stage that is sleeping.
+class StageLoadItem : public AbstractMenu::CustomItem
+{
+public:
+    void Init(Stage stage)
+    {
+        stage_ = stage;
+    }
+
+    void Draw(OneBitGraphicsDisplay &display, int currentIndex, int numItemsTotal, Rectangle boundsToDrawIn, bool isEditing) override
+    {
+        StageStats stats{profiler.Stats(stage_)};
+        uint32_t cycles[]{stats.min, stats.mean, stats.max, stats.p99};
+        const char *statNames[]{"min", "avg", "max", "p99"};
+
+        int16_t half{static_cast<int16_t>(boundsToDrawIn.GetHeight() / 2)};
+        Rectangle top{boundsToDrawIn.GetX(), boundsToDrawIn.GetY(), boundsToDrawIn.GetWidth(), half};
+        Rectangle bottom{boundsToDrawIn.GetX(), static_cast<int16_t>(boundsToDrawIn.GetY() + half), boundsToDrawIn.GetWidth(), half};
+
+        char text[12];
+        snprintf(text, sizeof(text), "%s%s%s", isEditing ? ">" : "", kStageNames[static_cast<int>(stage_)], profiler.Asleep(stage_) ? " zz" : "");
+        display.WriteStringAligned(text, Font_6x8, top, Alignment::centered, true);
+        snprintf(text, sizeof(text), "%s %d%%", statNames[stat_], profiler.Load(cycles[stat_]));
+        display.WriteStringAligned(text, Font_6x8, bottom, Alignment::centered, true);
+    }
+
+    bool CanBeEnteredForEditing() const override
+    {
+        return true;
+    }
+
+    void ModifyValue(int16_t increments, uint16_t stepsPerRevolution, bool isFunctionButtonPressed) override
+    {
+        stat_ = ((stat_ + increments) % 4 + 4) % 4;
+    }
+
+private:
+    Stage stage_;
+    int stat_{1};
+};
+StageLoadItem stageLoadItems[kStages];
+
+// Shows how much of the SDRAM arena the effects take.
+class MemoryItem : public AbstractMenu::CustomItem
+{
+public:
+    void Draw(OneBitGraphicsDisplay &display, int currentIndex, int numItemsTotal, Rectangle boundsToDrawIn, bool isEditing) override
+    {
+        int16_t half{static_cast<int16_t>(boundsToDrawIn.GetHeight() / 2)};
+        Rectangle top{boundsToDrawIn.GetX(), boundsToDrawIn.GetY(), boundsToDrawIn.GetWidth(), half};
+        Rectangle bottom{boundsToDrawIn.GetX(), static_cast<int16_t>(boundsToDrawIn.GetY() + half), boundsToDrawIn.GetWidth(), half};
+
+        char text[12];
+        display.WriteStringAligned("SDRAM", Font_6x8, top, Alignment::centered, true);
+        snprintf(text, sizeof(text), "%uK %u%%", static_cast<unsigned int>(sdram.Used() / 1024),
+                 static_cast<unsigned int>(100 * static_cast<uint64_t>(sdram.Used()) / sdram.Size()));
+        display.WriteStringAligned(text, Font_6x8, bottom, Alignment::centered, true);
+    }
+};
+MemoryItem memoryItem;
+
+// Scale and root of the pitch quantizer, read by the main loop.
+const char *scaleListValues[] = {"Ionian", "Dorian", "Phryg", "Lydian", "Mixo", "Aeol", "Locr"};
+MappedStringListValue scaleListValue(scaleListValues, kScales, static_cast<int>(kDefaultScale));
+const char *rootListValues[] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+MappedStringListValue rootListValue(rootListValues, 12, 0);
+
+// Source of each modulation target, knob 1 sets the cutoff by default.
+const char *modTargetNames[] = {"Pitch", "Char", "Cutoff", "Damp", "Size"};
+const char *modSourceNames[] = {"-", "Knob", "CV"};
+MappedStringListValue modSourceListValues[kModTargets]{
+    {modSourceNames, kModSources, 0},
+    {modSourceNames, kModSources, 0},
+    {modSourceNames, kModSources, static_cast<int>(ModSource::KNOB)},
+    {modSourceNames, kModSources, 0},
+    {modSourceNames, kModSources, 0},
+};
 
 /*
 // control menu items
@@ -85,51 +195,32 @@ void RandomizeEffects(void *context)
     randomize = RandomType::EFFECTS;
 }
 
-int basePitch;
-
 bool useEnvelope{true};
 
 
+// Fills and publishes a new patch, runs in the main loop. When the audio
+// callback hasn't picked up the previous one yet the request stays pending.
 void Randomize()
 {
-    if (RandomType::ALL == randomize) 
+    Patch *patch{patches.Acquire()};
+    if (!patch)
     {
-        generatorBank.Randomize();
-        effectBank.Randomize();
+        return;
     }
-    else if (RandomType::GENERATORS == randomize)
+    patch->hasGenerators = RandomType::ALL == randomize || RandomType::GENERATORS == randomize;
+    patch->hasEffects = RandomType::ALL == randomize || RandomType::EFFECTS == randomize;
+    if (patch->hasGenerators)
     {
-        generatorBank.Randomize();
+        generatorBank.Randomize(patch->generators);
     }
-    else if (RandomType::EFFECTS == randomize)
+    if (patch->hasEffects)
     {
-        effectBank.Randomize();
+        effectBank.Randomize(patch->effects);
     }
+    patches.Publish();
     randomize = RandomType::NONE;
 }
 
-void UpdateControls()
-{
-    knob1.Process();
-    knob2.Process();
-
-    bluemchen.seed.dac.WriteValue(daisy::DacHandle::Channel::ONE, static_cast<uint16_t>(knob1_dac.Process()));
-    bluemchen.seed.dac.WriteValue(daisy::DacHandle::Channel::TWO, static_cast<uint16_t>(knob2_dac.Process()));
-
-    cv1.Process();
-    cv2.Process();
-
-    generatorBank.SetEnvelopeGate(useEnvelope ? cv1.Value() > 0.5f : true);
-
-    if (std::abs(knob2Value - knob2.Value()) > 0.01f)
-    {
-        basePitch = 24 + knob2.Value() * 60;
-        knob2Value = knob2.Value();
-    }
-    float cvPitch{fmap(cv2.Value(), -30.f, 30.f)}; 
-    generatorBank.SetPitch(basePitch + cvPitch);
-}
-
 using OledDisplayType = decltype(Bluemchen::display);
 int canvasOledDisplay = 0;
 int bttnEncoder = 0;
@@ -184,6 +275,22 @@ void InitUiPages()
     mainMenuItems[0].text = "Random";
     mainMenuItems[0].asOpenUiPageItem.pageToOpen = &randomizerMenu;
 
+    mainMenuItems[1].type = daisy::AbstractMenu::ItemType::valueItem;
+    mainMenuItems[1].text = "Scale";
+    mainMenuItems[1].asMappedValueItem.valueToModify = &scaleListValue;
+
+    mainMenuItems[2].type = daisy::AbstractMenu::ItemType::valueItem;
+    mainMenuItems[2].text = "Root";
+    mainMenuItems[2].asMappedValueItem.valueToModify = &rootListValue;
+
+    mainMenuItems[3].type = daisy::AbstractMenu::ItemType::openUiPageItem;
+    mainMenuItems[3].text = "Mod";
+    mainMenuItems[3].asOpenUiPageItem.pageToOpen = &modMenu;
+
+    mainMenuItems[4].type = daisy::AbstractMenu::ItemType::openUiPageItem;
+    mainMenuItems[4].text = "Perf";
+    mainMenuItems[4].asOpenUiPageItem.pageToOpen = &profilerMenu;
+
     mainMenu.Init(mainMenuItems, kNumMainMenuItems);
 
     // ====================================================================
@@ -206,6 +313,43 @@ void InitUiPages()
     randomizerMenuItems[3].text = "Back";
 
     randomizerMenu.Init(randomizerMenuItems, kNumRandomizerMenuItems);
+
+    // ====================================================================
+    // The "modulation" menu, a source for each target
+    // ====================================================================
+
+    for (int i = 0; i < kModTargets; i++)
+    {
+        modMenuItems[i].type = daisy::AbstractMenu::ItemType::valueItem;
+        modMenuItems[i].text = modTargetNames[i];
+        modMenuItems[i].asMappedValueItem.valueToModify = &modSourceListValues[i];
+    }
+
+    modMenuItems[kModTargets].type = daisy::AbstractMenu::ItemType::closeMenuItem;
+    modMenuItems[kModTargets].text = "Back";
+
+    modMenu.Init(modMenuItems, kNumModMenuItems);
+
+    // ====================================================================
+    // The "profiler" menu, only shows data when built with ORCHARD_PROFILE
+    // ====================================================================
+
+    for (int i = 0; i < kStages; i++)
+    {
+        stageLoadItems[i].Init(static_cast<Stage>(i));
+        profilerMenuItems[i].type = daisy::AbstractMenu::ItemType::customItem;
+        profilerMenuItems[i].text = kStageNames[i];
+        profilerMenuItems[i].asCustomItem.itemObject = &stageLoadItems[i];
+    }
+
+    profilerMenuItems[kStages].type = daisy::AbstractMenu::ItemType::customItem;
+    profilerMenuItems[kStages].text = "Mem";
+    profilerMenuItems[kStages].asCustomItem.itemObject = &memoryItem;
+
+    profilerMenuItems[kStages + 1].type = daisy::AbstractMenu::ItemType::closeMenuItem;
+    profilerMenuItems[kStages + 1].text = "Back";
+
+    profilerMenu.Init(profilerMenuItems, kNumProfilerMenuItems);
 }
 
 void GenerateUiEvents()
@@ -221,27 +365,100 @@ void GenerateUiEvents()
         eventQueue.AddEncoderTurned(encoderMain, increments, 12);
 }
 
-void AudioCallback(AudioHandle::InputBuffer in, AudioHandle::OutputBuffer out, size_t size)
+// Scans the controls, runs once per tick of the main loop.
+void UpdateControls()
 {
     bluemchen.ProcessAllControls();
     GenerateUiEvents();
 
-    for (size_t i = 0; i < size; i++)
+    const bool knob1Changed{knob1.Process(bluemchen.controls[bluemchen.CTRL_1].Value())};
+    const bool knob2Changed{knob2.Process(bluemchen.controls[bluemchen.CTRL_2].Value())};
+    // The knobs go out on the 12 bit DAC, as 0 to 4095.
+    if (knob1Changed)
     {
-        float left{0.f};
-        float right{0.f};
+        bluemchen.seed.dac.WriteValue(daisy::DacHandle::Channel::ONE, static_cast<uint16_t>(knob1.Value() * 4095.f));
+    }
+    if (knob2Changed)
+    {
+        bluemchen.seed.dac.WriteValue(daisy::DacHandle::Channel::TWO, static_cast<uint16_t>(knob2.Value() * 4095.f));
+    }
+
+    cv1.Process(bluemchen.controls[bluemchen.CTRL_3].Value());
+    gateHigh = cv1.State();
 
-        generatorBank.Process(left, right);
-        effectBank.Process(left, right);
+    scaleIndex = scaleListValue.GetIndex();
+    rootIndex = rootListValue.GetIndex();
+    for (int i = 0; i < kModTargets; i++)
+    {
+        modRoutes[i] = modSourceListValues[i].GetIndex();
+    }
+    // CV 2 moves the quantized pitch, unless it modulates the pitch.
+    const bool cvModulates{ModSource::CV == static_cast<ModSource>(modRoutes[static_cast<int>(ModTarget::PITCH)])};
+    const bool cv2Changed{cv2.Process(bluemchen.controls[bluemchen.CTRL_4].Value())};
+    if (knob2Changed || cv2Changed || cvModulates != cvPitchModulates)
+    {
+        cvPitchModulates = cvModulates;
+        const float basePitch{24 + knob2.Value() * 60};
+        const float cvPitch{cvModulates ? 0.f : fmap(cv2.Value(), -30.f, 30.f)};
+        pitch = basePitch + cvPitch;
+    }
+}
 
-        OUT_L[i] = balancer.Process(left, 0.25f);
-        OUT_R[i] = balancer.Process(right, 0.25f);
+void AudioCallback(AudioHandle::InputBuffer in, AudioHandle::OutputBuffer out, size_t size)
+{
+    FlushDenormals();
+
+    // Only a change of scale or root rebuilds the quantizer tables. They come
+    // before the patch, so that the generators it switches on start at their
+    // pitch.
+    generatorBank.SetScale(static_cast<Scale>(scaleIndex));
+    generatorBank.SetRoot(rootIndex);
+    generatorBank.SetPitch(pitch);
+    const Patch *patch{patches.Peek()};
+    if (patch)
+    {
+        ApplyPatch(*patch, generatorBank, effectBank);
+        patches.Release();
+    }
+    // The gate drives the envelopes and clocks the delay.
+    generatorBank.SetEnvelopeGate(useEnvelope ? gateHigh : true);
+    effectBank.SetClock(gateHigh);
+    for (int i = 0; i < kModTargets; i++)
+    {
+        modMatrix.SetRoute(static_cast<ModTarget>(i), static_cast<ModSource>(modRoutes[i]));
     }
+    // The modulation sources, bipolar. The knob as held by its hysteresis, so
+    // that the ADC noise doesn't move the target, the CV as last scanned.
+    modMatrix.SetSource(ModSource::KNOB, 2.f * knob1.Value() - 1.f);
+    modMatrix.SetSource(ModSource::CV, 2.f * bluemchen.controls[bluemchen.CTRL_4].Value() - 1.f);
+    ApplyModulation(modMatrix, generatorBank, effectBank);
 
-    if (RandomType::NONE != randomize) 
     {
-        Randomize();
+        PROFILE_STAGE(Stage::BLOCK);
+        // The buffers of the banks hold kMaxBlockSize samples, a larger audio
+        // block is processed in several parts.
+        for (size_t offset = 0; offset < size; offset += kMaxBlockSize)
+        {
+            const size_t n{std::min(kMaxBlockSize, size - offset)};
+            float left[kMaxBlockSize]{};
+            float right[kMaxBlockSize]{};
+
+            {
+                PROFILE_STAGE(Stage::GENERATORS);
+                generatorBank.ProcessBlock(left, right, n);
+            }
+            effectBank.ProcessBlock(left, right, n);
+
+            PROFILE_STAGE(Stage::OUTPUT);
+            limiter.ProcessBlock(left, right, n);
+            for (size_t i = 0; i < n; i++)
+            {
+                OUT_L[offset + i] = left[i];
+                OUT_R[offset + i] = right[i];
+            }
+        }
     }
+    PROFILE_END_BLOCK();
 }
 
 int main(void)
@@ -249,14 +466,11 @@ int main(void)
     bluemchen.Init();
     bluemchen.StartAdc();
 
-    knob1.Init(bluemchen.controls[bluemchen.CTRL_1], 0.0f, 1.0f, Parameter::LINEAR);
-    knob2.Init(bluemchen.controls[bluemchen.CTRL_2], 0.0f, 1.0f, Parameter::LINEAR);
-
-    knob1_dac.Init(bluemchen.controls[bluemchen.CTRL_1], 0.0f, 1.0f, Parameter::LINEAR);
-    knob2_dac.Init(bluemchen.controls[bluemchen.CTRL_2], 0.0f, 1.0f, Parameter::LINEAR);
-
-    cv1.Init(bluemchen.controls[bluemchen.CTRL_3], 0.0f, 1.0f, Parameter::LINEAR);
-    cv2.Init(bluemchen.controls[bluemchen.CTRL_4], 0.0f, 1.0f, Parameter::LINEAR);
+    // A knob step is about half a semitone, a CV step a tenth.
+    knob1.Init(0.01f, -1.f);
+    knob2.Init(0.01f, -1.f);
+    cv1.Init(0.45f, 0.55f);
+    cv2.Init(0.002f, -1.f);
 
     sampleRate = bluemchen.AudioSampleRate();
 
@@ -267,19 +481,52 @@ int main(void)
     UI::SpecialControlIds ids;
 
     generatorBank.Init(sampleRate);
-    effectBank.Init(sampleRate);
-    balancer.Init(sampleRate);
+    sdram.Init(sdramMemory, sizeof(sdramMemory));
+    if (!effectBank.Init(sampleRate, sdram, kReverbType))
+    {
+        // The effect buffers don't fit, don't start the audio.
+        bluemchen.display.Fill(false);
+        bluemchen.display.SetCursor(0, 0);
+        bluemchen.display.WriteString("No SDRAM", Font_6x8, true);
+        bluemchen.display.Update();
+        while (1)
+        {
+        }
+    }
+    limiter.Init(sampleRate, 0.89f, kOutputGain);
+    profiler.Init(sampleRate, bluemchen.seed.AudioBlockSize(), System::GetSysClkFreq());
 
-    // New seed.
-    srand(time(NULL));
+    // New seed, the host renderer gives the same patches for the same seed.
+    const uint32_t seed{static_cast<uint32_t>(time(NULL))};
+    generatorBank.Seed(seed);
+    effectBank.Seed(seed);
     Randomize();
+    generatorBank.SetScale(static_cast<Scale>(scaleIndex));
+    generatorBank.SetRoot(rootIndex);
+    generatorBank.SetPitch(pitch);
+    ApplyPatch(*patches.Peek(), generatorBank, effectBank);
+    patches.Release();
 
     bluemchen.StartAudio(AudioCallback);
 
+    // One tick per millisecond of the system timer, the loop waits for the
+    // next one instead of scanning the controls as fast as it can.
+    lastControlTick = System::GetNow();
     while (1)
     {
-        ui.Process();
+        const uint32_t now{System::GetNow()};
+        if (now == lastControlTick)
+        {
+            continue;
+        }
+        lastControlTick = now;
+
         UpdateControls();
+        ui.Process();
+        if (RandomType::NONE != randomize)
+        {
+            Randomize();
+        }
         //UpdateMenu();
         //UpdateOled();
     }
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "Utility/dsp.h"
+
+#include "arena.h"
+#include "commons.h"
+#include "delaylines.h"
+#include "denormals.h"
+
+namespace orchard
+{
+    using namespace daisysp;
+
+    // Delay times with a clock, as fractions of its period.
+    constexpr int kDelayDivisions{9};
+    constexpr float kDelayDivisionRatios[kDelayDivisions]{0.25f, 1.f / 3.f, 0.375f, 0.5f, 2.f / 3.f, 0.75f, 1.f, 1.5f, 2.f};
+
+    // Length of the crossfade between the old and the new time, in seconds.
+    constexpr float kDelayCrossfade{0.02f};
+    // Smaller changes of the time are ignored, so that the jitter of the
+    // clock doesn't keep the delay crossfading.
+    constexpr float kDelayTolerance{0.003f};
+    // Clock periods outside of this range are ignored, without edges for
+    // longer than kMaxClockPeriod the delay goes back to its free times.
+    constexpr float kMinClockPeriod{0.05f};
+    constexpr float kMaxClockPeriod{4.f};
+
+    // Stereo delay with independent times for the two channels and a low pass
+    // in the feedback path. With a clock each time is a division of its
+    // period, otherwise it is free. The times are whole samples, a new time is
+    // reached by crossfading between two reads of the line, so each block
+    // only costs block copies, and two more while crossfading.
+    class ClockedDelay
+    {
+    public:
+        ClockedDelay() {}
+        ~ClockedDelay() {}
+
+        // The lines are taken from arena, returns false if they don't fit.
+        bool Init(float sampleRate, Arena &arena)
+        {
+            sampleRate_ = sampleRate;
+            maxDelay_ = static_cast<size_t>(kMaxDelayTime * sampleRate_);
+            tolerance_ = static_cast<size_t>(kDelayTolerance * sampleRate_);
+            minClock_ = static_cast<uint32_t>(kMinClockPeriod * sampleRate_);
+            maxClock_ = static_cast<uint32_t>(kMaxClockPeriod * sampleRate_);
+            fadeIncrement_ = 1.f / (kDelayCrossfade * sampleRate_);
+            for (int c = 0; c < 2; c++)
+            {
+                Channel &channel{channels_[c]};
+                if (!channel.line.Init(arena, maxDelay_))
+                {
+                    return false;
+                }
+                channel.delay = maxDelay_ / 2;
+                channel.next = channel.delay;
+                channel.target = channel.delay;
+                channel.fading = false;
+                channel.fade = 0.f;
+                channel.damp = 0.f;
+                times_[c] = static_cast<float>(channel.delay);
+                divisions_[c] = kDelayDivisions - 1;
+            }
+            now_ = 0;
+            // The first edge gives no period.
+            lastTick_ = now_ - maxClock_ - 1;
+            period_ = 0;
+            synced_ = false;
+
+            SetFeedback(0.f);
+            SetDamp(sampleRate_ / 3.f);
+
+            return true;
+        }
+
+        void SetFeedback(float feedback)
+        {
+            feedback_ = fclamp(feedback, 0.f, 0.98f);
+        }
+
+        // Cutoff of the low pass in the feedback path.
+        void SetDamp(float freq)
+        {
+            dampCoeff_ = 1.f - expf(-TWOPI_F * fclamp(freq, 20.f, sampleRate_ / 3.f) / sampleRate_);
+        }
+
+        // Times without clock, in samples.
+        void SetTimes(float left, float right)
+        {
+            times_[0] = left;
+            times_[1] = right;
+            Retarget();
+        }
+
+        // Times with clock, indexes in kDelayDivisionRatios.
+        void SetDivisions(int left, int right)
+        {
+            divisions_[0] = std::min(std::max(left, 0), kDelayDivisions - 1);
+            divisions_[1] = std::min(std::max(right, 0), kDelayDivisions - 1);
+            Retarget();
+        }
+
+        // Rising edge of the clock, between two blocks.
+        void Tick()
+        {
+            const uint32_t period{now_ - lastTick_};
+            lastTick_ = now_;
+            if (period >= minClock_ && period <= maxClock_)
+            {
+                period_ = period;
+                synced_ = true;
+                Retarget();
+            }
+        }
+
+        bool Synced() const
+        {
+            return synced_;
+        }
+
+        // Longest time in use or being reached, in samples.
+        float Longest() const
+        {
+            size_t longest{0};
+            for (int c = 0; c < 2; c++)
+            {
+                longest = std::max(longest, std::max(channels_[c].delay, std::max(channels_[c].next, channels_[c].target)));
+            }
+
+            return static_cast<float>(longest);
+        }
+
+        // Keeps time for the blocks that are not processed, pending time
+        // changes happen at once.
+        void Idle(size_t n)
+        {
+            Advance(n);
+            for (int c = 0; c < 2; c++)
+            {
+                channels_[c].delay = channels_[c].target;
+                channels_[c].next = channels_[c].target;
+                channels_[c].fading = false;
+            }
+        }
+
+        // Writes n samples of the delayed signal, n must not exceed
+        // kMaxBlockSize.
+        void ProcessBlock(const float *inLeft, const float *inRight, float *outLeft, float *outRight, size_t n)
+        {
+            const float *in[2]{inLeft, inRight};
+            float *out[2]{outLeft, outRight};
+            for (int c = 0; c < 2; c++)
+            {
+                Channel &channel{channels_[c]};
+                channel.line.Read(channel.delay, out[c], n);
+                if (channel.fading)
+                {
+                    float next[kMaxBlockSize];
+                    channel.line.Read(channel.next, next, n);
+                    float fade{channel.fade};
+                    for (size_t i = 0; i < n; i++)
+                    {
+                        fade = std::min(fade + fadeIncrement_, 1.f);
+                        out[c][i] += (next[i] - out[c][i]) * fade;
+                    }
+                    channel.fade = fade;
+                    if (fade >= 1.f)
+                    {
+                        channel.delay = channel.next;
+                        channel.fading = false;
+                        StartFade(channel);
+                    }
+                }
+
+                float write[kMaxBlockSize];
+                float damp{channel.damp};
+                for (size_t i = 0; i < n; i++)
+                {
+                    damp += dampCoeff_ * (out[c][i] - damp);
+                    write[i] = FlushDenormal(in[c][i] + feedback_ * damp);
+                }
+                channel.damp = damp;
+                channel.line.Write(write, n);
+            }
+            Advance(n);
+        }
+
+    private:
+        struct Channel
+        {
+            BlockDelayLine line;
+            // Current time, time being crossfaded to and last time asked
+            // for, in samples.
+            size_t delay;
+            size_t next;
+            size_t target;
+            bool fading;
+            float fade;
+            float damp;
+        };
+
+        void Advance(size_t n)
+        {
+            now_ += static_cast<uint32_t>(n);
+            if (synced_ && now_ - lastTick_ > maxClock_)
+            {
+                synced_ = false;
+                Retarget();
+            }
+        }
+
+        void Retarget()
+        {
+            for (int c = 0; c < 2; c++)
+            {
+                float time{times_[c]};
+                if (synced_)
+                {
+                    // Too long divisions are taken an octave down.
+                    time = period_ * kDelayDivisionRatios[divisions_[c]];
+                    while (time > maxDelay_)
+                    {
+                        time *= 0.5f;
+                    }
+                }
+                const size_t target{std::min(std::max(static_cast<size_t>(time), kMaxBlockSize), maxDelay_)};
+                Channel &channel{channels_[c]};
+                const size_t difference{target > channel.target ? target - channel.target : channel.target - target};
+                if (difference > tolerance_)
+                {
+                    channel.target = target;
+                    StartFade(channel);
+                }
+            }
+        }
+
+        // Starts moving towards the last target, unless already crossfading:
+        // the crossfade in progress ends first.
+        void StartFade(Channel &channel)
+        {
+            if (channel.fading || channel.target == channel.delay)
+            {
+                return;
+            }
+            channel.next = channel.target;
+            channel.fading = true;
+            channel.fade = 0.f;
+        }
+
+        Channel channels_[2];
+        float times_[2];
+        int divisions_[2];
+        float sampleRate_;
+        size_t maxDelay_;
+        size_t tolerance_;
+        float fadeIncrement_;
+        float feedback_;
+        float dampCoeff_;
+
+        // Samples processed, time of the last clock edge and clock period.
+        uint32_t now_;
+        uint32_t lastTick_;
+        uint32_t period_;
+        uint32_t minClock_;
+        uint32_t maxClock_;
+        bool synced_;
+    };
+}
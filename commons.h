@@ -1,14 +1,49 @@
 #pragma once
 
-#include "Utility/delayline.h"
-#include "Utility/dsp.h"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 
-#define MAX_DELAY static_cast<size_t>(48000 * 1.f)
+#include "Utility/dsp.h"
 
 namespace orchard
 {
     using namespace daisysp;
 
+    // Largest block handled by the ProcessBlock functions.
+    constexpr size_t kMaxBlockSize{256};
+
+    // Blocks are split in sub-blocks of this size when the modulation moves,
+    // see BlockRamp.
+    constexpr size_t kSubBlockSize{16};
+    constexpr size_t kMaxSubBlocks{kMaxBlockSize / kSubBlockSize};
+
+    // Highest supported sample rate, the buffers in internal RAM are sized for
+    // it.
+    constexpr float kMaxSampleRate{96000.f};
+
+    // Gain before the output limiter.
+    constexpr float kOutputGain{2.f};
+
+    // Longest time of the delay effect, in seconds.
+    constexpr float kMaxDelayTime{1.f};
+
+    // Level below which a signal counts as silence, about -100 dB.
+    constexpr float kSilence{1e-5f};
+
+    // Samples taken by a feedback loop of the given length, in samples, and
+    // gain to decay from full scale to below threshold, the first pass
+    // included. Gains close to 1 are taken as kMaxTailGain, so that the tail
+    // is finite.
+    constexpr float kMaxTailGain{0.999f};
+
+    inline float FeedbackTail(float loop, float gain, float threshold)
+    {
+        gain = fclamp(gain, 0.f, kMaxTailGain);
+
+        return gain > 0.f ? loop * (1.f + logf(threshold) / logf(gain)) : loop;
+    }
+
     enum class Range
     {
         FULL,
@@ -16,11 +51,6 @@ namespace orchard
         LOW,
     };
 
-    float RandomFloat(float min, float max)
-    {
-        return min + static_cast<float>(std::rand()) / (static_cast<float>(RAND_MAX / (max - min)));
-    }
-
     enum class Scale
     {
         IONIAN,
@@ -40,7 +70,7 @@ namespace orchard
     // Mixolydian     w-w-h-w-w-h-w
     // Aeolian          w-h-w-w-h-w-w
     // Locrian            h-w-w-h-w-w-w
-    int scales[static_cast<unsigned int>(Scale::LAST_SCALE)][scaleIntervals]{
+    constexpr int scales[static_cast<unsigned int>(Scale::LAST_SCALE)][scaleIntervals]{
         {-12, -10, -8, -7, -5, -3, -1, 0, 2, 4, 5, 7, 9, 11, 12},
         {-12, -10, -9, -7, -5, -3, -2, 0, 2, 3, 5, 7, 9, 10, 12},
         {-12, -11, -9, -7, -5, -4, -2, 0, 1, 3, 5, 7, 8, 10, 12},
@@ -50,50 +80,129 @@ namespace orchard
         {-12, -11, -9, -7, -6, -4, -2, 0, 1, 3, 5, 6, 8, 10, 12},
     };
 
-    Scale currentScale{Scale::PHRYGIAN};
-
-    int RandomInterval(Range range)
+    // Small seedable random generator (xorshift32), each bank owns one so that
+    // a seed always gives the same patch, on the hardware and in the host
+    // renderer. Ranges are mapped with a multiply instead of a division.
+    class Prng
     {
-        int rnd;
+    public:
+        Prng() {}
+        ~Prng() {}
 
-        if (Range::HIGH == range)
+        // Different streams give unrelated sequences for the same seed.
+        void Seed(uint32_t seed, uint32_t stream = 0)
         {
-            int half{static_cast<int>(std::ceil(scaleIntervals / 2))};
-            rnd = (half + (std::rand() % half)) - 1;
+            // Scramble the seed (splitmix32) so that close seeds don't give
+            // close sequences, xorshift never leaves a zero state.
+            uint32_t z{seed + (stream + 1) * 0x9e3779b9u};
+            z = (z ^ (z >> 16)) * 0x85ebca6bu;
+            z = (z ^ (z >> 13)) * 0xc2b2ae35u;
+            z ^= z >> 16;
+            state_ = 0 == z ? 0x6d2b79f5u : z;
         }
-        else if (Range::LOW == range)
+
+        // The state can be saved before a Randomize and restored to get the
+        // same patch again.
+        uint32_t State() const
         {
-            int half{static_cast<int>(std::ceil(scaleIntervals / 2))};
-            rnd = std::rand() % half - 1;
+            return state_;
         }
-        else
+
+        void SetState(uint32_t state)
         {
-            rnd = std::rand() % scaleIntervals;
+            state_ = 0 == state ? 0x6d2b79f5u : state;
         }
 
-        return rnd;
-    }
+        inline uint32_t Next()
+        {
+            state_ ^= state_ << 13;
+            state_ ^= state_ >> 17;
+            state_ ^= state_ << 5;
 
-    int RandomPitch(Range range)
-    {
-        int rnd;
+            return state_;
+        }
 
-        if (Range::HIGH == range)
+        // Between 0 and n - 1.
+        inline uint32_t Int(uint32_t n)
         {
-            // (midi 66-72)
-            rnd = RandomFloat(42, 72);
+            return static_cast<uint32_t>((static_cast<uint64_t>(Next()) * n) >> 32);
         }
-        else if (Range::LOW == range)
+
+        // Between 0 and 1, excluded.
+        inline float Float()
         {
-            // (midi 36-65)
-            rnd = RandomFloat(12, 41);
+            return (Next() >> 8) * (1.f / 16777216.f);
         }
-        else
+
+        inline float Float(float min, float max)
+        {
+            return min + (max - min) * Float();
+        }
+
+        inline bool Chance(uint32_t n)
+        {
+            return 0 == Int(n);
+        }
+
+        // Index in a row of scales, the low range is mostly below the root and
+        // the high one above it.
+        int Interval(Range range)
+        {
+            constexpr int half{scaleIntervals / 2};
+            if (Range::HIGH == range)
+            {
+                return half + Int(half) - 1;
+            }
+            if (Range::LOW == range)
+            {
+                return Int(half);
+            }
+
+            return Int(scaleIntervals);
+        }
+
+        int Pitch(Range range)
         {
+            if (Range::HIGH == range)
+            {
+                // (midi 66-72)
+                return Float(42, 72);
+            }
+            if (Range::LOW == range)
+            {
+                // (midi 36-65)
+                return Float(12, 41);
+            }
+
             // (midi 36-96)
-            rnd = RandomFloat(12, 72);
+            return Float(12, 72);
         }
 
-        return rnd;
-    }
-}
\ No newline at end of file
+        void Fill(float *out, size_t n, float min, float max)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                out[i] = Float(min, max);
+            }
+        }
+
+        void FillIntervals(int *out, size_t n, Range range)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                out[i] = Interval(range);
+            }
+        }
+
+        void FillPitches(float *out, size_t n, Range range)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                out[i] = Pitch(range);
+            }
+        }
+
+    private:
+        uint32_t state_{0x6d2b79f5u};
+    };
+}
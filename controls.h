@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cmath>
+
+namespace orchard
+{
+    // Holds a control value until the input moves away from it by more than
+    // the threshold, so that the noise of the ADC doesn't count as a change.
+    class Hysteresis
+    {
+    public:
+        Hysteresis() {}
+        ~Hysteresis() {}
+
+        void Init(float threshold, float value = 0.f)
+        {
+            threshold_ = threshold;
+            value_ = value;
+        }
+
+        // Returns true if the held value changed.
+        bool Process(float in)
+        {
+            if (std::fabs(in - value_) <= threshold_)
+            {
+                return false;
+            }
+            value_ = in;
+
+            return true;
+        }
+
+        float Value() const
+        {
+            return value_;
+        }
+
+    private:
+        float threshold_{0.f};
+        float value_{0.f};
+    };
+
+    // Gate with two thresholds, it goes high above the high one and low
+    // below the low one.
+    class SchmittTrigger
+    {
+    public:
+        SchmittTrigger() {}
+        ~SchmittTrigger() {}
+
+        void Init(float low, float high)
+        {
+            low_ = low;
+            high_ = high;
+            state_ = false;
+        }
+
+        // Returns true if the state changed.
+        bool Process(float in)
+        {
+            const bool state{state_ ? in > low_ : in > high_};
+            const bool changed{state != state_};
+            state_ = state;
+
+            return changed;
+        }
+
+        bool State() const
+        {
+            return state_;
+        }
+
+    private:
+        float low_{0.45f};
+        float high_{0.55f};
+        bool state_{false};
+    };
+}
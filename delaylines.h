@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+#include "arena.h"
+
+namespace orchard
+{
+    constexpr size_t NextPowerOfTwo(size_t n)
+    {
+        size_t size{1};
+        while (size < n)
+        {
+            size <<= 1;
+        }
+
+        return size;
+    }
+
+    // Delay line with a power of two length, so that the ring buffer wraps
+    // with a mask. It reads as daisysp::DelayLine does.
+    template <size_t size>
+    class MaskedDelayLine
+    {
+        static_assert(0 == (size & (size - 1)), "The size must be a power of two");
+
+    public:
+        MaskedDelayLine() {}
+        ~MaskedDelayLine() {}
+
+        void Init()
+        {
+            std::fill(line_, line_ + size, 0.f);
+            writePtr_ = 0;
+        }
+
+        inline float Read(float delay) const
+        {
+            const size_t intDelay{std::min(static_cast<size_t>(delay), size - 1)};
+            const float frac{delay - static_cast<float>(intDelay)};
+            const float a{line_[(writePtr_ + intDelay) & kMask]};
+            const float b{line_[(writePtr_ + intDelay + 1) & kMask]};
+
+            return a + (b - a) * frac;
+        }
+
+        inline void Write(float sample)
+        {
+            line_[writePtr_] = sample;
+            writePtr_ = (writePtr_ - 1) & kMask;
+        }
+
+    private:
+        static constexpr size_t kMask{size - 1};
+
+        float line_[size];
+        size_t writePtr_{0};
+    };
+
+    // Delay line read and written a block at a time, with whole sample delays
+    // between the block size and the length of the line. Each read or write
+    // is at most two copies, the ring buffer only wraps between them. The
+    // buffer is taken from an arena.
+    class BlockDelayLine
+    {
+    public:
+        BlockDelayLine() {}
+        ~BlockDelayLine() {}
+
+        // Returns false if the arena has no room for maxDelay samples.
+        bool Init(Arena &arena, size_t maxDelay)
+        {
+            size_ = NextPowerOfTwo(maxDelay);
+            mask_ = size_ - 1;
+            writePtr_ = 0;
+            line_ = arena.Allocate<float>(size_);
+
+            return nullptr != line_;
+        }
+
+        void Reset()
+        {
+            std::fill(line_, line_ + size_, 0.f);
+            writePtr_ = 0;
+        }
+
+        size_t Size() const
+        {
+            return size_;
+        }
+
+        // Reads the n samples written delay samples before the next block,
+        // delay must be between n and Size().
+        void Read(size_t delay, float *out, size_t n) const
+        {
+            const size_t start{(writePtr_ - delay) & mask_};
+            const size_t first{std::min(n, size_ - start)};
+            std::copy(line_ + start, line_ + start + first, out);
+            std::copy(line_, line_ + n - first, out + first);
+        }
+
+        void Write(const float *in, size_t n)
+        {
+            const size_t first{std::min(n, size_ - writePtr_)};
+            std::copy(in, in + first, line_ + writePtr_);
+            std::copy(in + first, in + n, line_);
+            writePtr_ = (writePtr_ + n) & mask_;
+        }
+
+    private:
+        float *line_{nullptr};
+        size_t size_{0};
+        size_t mask_{0};
+        size_t writePtr_{0};
+    };
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif
+
+namespace orchard
+{
+    // Makes the FPU of the calling thread flush denormal results and
+    // operands to zero. The decaying tails of the feedback loops otherwise
+    // end up as denormals, which are many times slower on x86. It must be
+    // called on entry to the audio callback: on the Cortex-M7 each exception
+    // handler starts with the FPSCR taken from FPDSCR, so both are set.
+    inline void FlushDenormals()
+    {
+#if defined(__arm__)
+        uint32_t fpscr;
+        asm volatile("vmrs %0, fpscr" : "=r"(fpscr));
+        asm volatile("vmsr fpscr, %0" : : "r"(fpscr | (1u << 24))); // FZ
+        *reinterpret_cast<volatile uint32_t *>(0xE000EF3C) |= 1u << 24; // FPDSCR
+#elif defined(__aarch64__)
+        uint64_t fpcr;
+        asm volatile("mrs %0, fpcr" : "=r"(fpcr));
+        asm volatile("msr fpcr, %0" : : "r"(fpcr | (1ull << 24))); // FZ
+#elif defined(__x86_64__) || defined(__i386__)
+        _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ and DAZ
+#endif
+    }
+
+    // Values that feedback writes round to zero. Far below anything audible,
+    // and far above the denormal range.
+    constexpr float kDenormalThreshold{1e-20f};
+
+    // Cheap guard for the writes in feedback loops, in case the FPU is not
+    // set as FlushDenormals does.
+    inline float FlushDenormal(float x)
+    {
+        return std::fabs(x) < kDenormalThreshold ? 0.f : x;
+    }
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <cmath>
+
+#include "Utility/dsp.h"
+
+#include "commons.h"
+#include "delaylines.h"
+#include "denormals.h"
+#include "tables.h"
+
+namespace orchard
+{
+    using namespace daisysp;
+
+    constexpr int kDiffusers{4};
+
+    // Allpass times at the bottom of their LFO and lengths of the feedback
+    // loops, in ms. The right channel times are stretched by kStereoSpread.
+    constexpr float kDiffuserTimes[kDiffusers]{3.0f, 2.2f, 7.9f, 5.8f};
+    constexpr float kMaxDiffuserTime{7.9f};
+    constexpr float kLoopTimes[2]{29.7f, 37.1f};
+    constexpr float kMaxLoopTime{37.1f};
+    constexpr float kStereoSpread{1.07f};
+    constexpr float kMaxLfoDepth{1.f};
+
+    constexpr float kMaxDiffuserDelay{(kMaxDiffuserTime * kStereoSpread + kMaxLfoDepth) * 0.001f * kMaxSampleRate};
+    constexpr size_t kDiffuserLineSize{NextPowerOfTwo(static_cast<size_t>(kMaxDiffuserDelay) + 2)};
+    static_assert(kMaxDiffuserDelay + 2 <= kDiffuserLineSize, "The diffuser lines are too short");
+    constexpr float kMaxLoopDelay{kMaxLoopTime * 0.001f * kMaxSampleRate};
+    constexpr size_t kLoopLineSize{NextPowerOfTwo(static_cast<size_t>(kMaxLoopDelay) + 2)};
+    static_assert(kMaxLoopDelay + 2 <= kLoopLineSize, "The loop lines are too short");
+
+    // Reverb made of 4 allpass diffusers in series per channel, each with a
+    // sine LFO on its delay time (a quarter of period apart), fed by a high
+    // shelf (midi 96) and a low shelf (midi 60) in series. The end of each
+    // chain goes back, low pass filtered, to the input of the other one. The
+    // LFOs move once per block and all the lines are short enough for the
+    // internal RAM.
+    class DiffuserReverb
+    {
+    public:
+        DiffuserReverb() {}
+        ~DiffuserReverb() {}
+
+        void Init(float sampleRate)
+        {
+            sampleRate_ = sampleRate;
+            for (int c = 0; c < 2; c++)
+            {
+                for (int k = 0; k < kDiffusers; k++)
+                {
+                    lines_[c][k].Init();
+                    baseDelays_[c][k] = kDiffuserTimes[k] * (c ? kStereoSpread : 1.f) * 0.001f * sampleRate_;
+                    delays_[c][k] = baseDelays_[c][k];
+                }
+                loops_[c].Init();
+                loopDelays_[c] = kLoopTimes[c] * 0.001f * sampleRate_;
+                highShelf_[c] = 0.f;
+                lowShelf_[c] = 0.f;
+                damp_[c] = 0.f;
+            }
+            highShelfCoeff_ = OnePoleCoeff(Mtof(96.f));
+            lowShelfCoeff_ = OnePoleCoeff(Mtof(60.f));
+            phase_ = 0.f;
+
+            SetFeedback(0.5f);
+            SetLpFreq(10000.f);
+            SetHfDamp(0.f);
+            SetLfDamp(0.f);
+            SetDiffusion(0.6f);
+            SetLfoFreq(0.5f);
+            SetLfoDepth(0.3f);
+        }
+
+        // Reverb time.
+        void SetFeedback(float feedback)
+        {
+            feedback_ = fclamp(feedback, 0.f, 0.98f);
+        }
+
+        // Cutoff of the low pass in the feedback loops.
+        void SetLpFreq(float freq)
+        {
+            lpCoeff_ = OnePoleCoeff(fclamp(freq, 20.f, sampleRate_ / 3.f));
+        }
+
+        // Attenuation of the input shelves, 0 leaves the input untouched.
+        void SetHfDamp(float damp)
+        {
+            hfGain_ = 1.f - fclamp(damp, 0.f, 1.f);
+        }
+
+        void SetLfDamp(float damp)
+        {
+            lfGain_ = 1.f - fclamp(damp, 0.f, 1.f);
+        }
+
+        // Room size, the allpass coefficient.
+        void SetDiffusion(float diffusion)
+        {
+            diffusion_ = fclamp(diffusion, 0.f, 0.8f);
+        }
+
+        void SetLfoFreq(float freq)
+        {
+            lfoIncrement_ = fclamp(freq, 0.f, 10.f) / sampleRate_;
+        }
+
+        // Between 0 and 1, for up to kMaxLfoDepth ms of modulation.
+        void SetLfoDepth(float depth)
+        {
+            lfoDepth_ = fclamp(depth, 0.f, 1.f) * kMaxLfoDepth * 0.001f * sampleRate_;
+        }
+
+        void Process(float inLeft, float inRight, float *outLeft, float *outRight)
+        {
+            ProcessBlock(&inLeft, &inRight, outLeft, outRight, 1);
+        }
+
+        void ProcessBlock(const float *inLeft, const float *inRight, float *outLeft, float *outRight, size_t n)
+        {
+            // The LFOs move once per block, the delay times are interpolated
+            // along it.
+            phase_ += lfoIncrement_ * n;
+            if (phase_ >= 1.f)
+            {
+                phase_ -= 1.f;
+            }
+            float delays[2][kDiffusers];
+            float increments[2][kDiffusers];
+            for (int k = 0; k < kDiffusers; k++)
+            {
+                const float lfo{0.5f + 0.5f * sinf(TWOPI_F * (phase_ + 0.25f * k))};
+                for (int c = 0; c < 2; c++)
+                {
+                    const float target{baseDelays_[c][k] + lfoDepth_ * lfo};
+                    delays[c][k] = delays_[c][k];
+                    increments[c][k] = (target - delays_[c][k]) / n;
+                    delays_[c][k] = target;
+                }
+            }
+
+            for (size_t i = 0; i < n; i++)
+            {
+                const float in[2]{inLeft[i], inRight[i]};
+                const float loop[2]{loops_[0].Read(loopDelays_[0]), loops_[1].Read(loopDelays_[1])};
+                float out[2];
+                for (int c = 0; c < 2; c++)
+                {
+                    // Input shelves.
+                    float x{in[c]};
+                    highShelf_[c] += highShelfCoeff_ * (x - highShelf_[c]);
+                    x = highShelf_[c] + hfGain_ * (x - highShelf_[c]);
+                    lowShelf_[c] += lowShelfCoeff_ * (x - lowShelf_[c]);
+                    x = lfGain_ * lowShelf_[c] + (x - lowShelf_[c]);
+
+                    x += feedback_ * loop[1 - c];
+                    for (int k = 0; k < kDiffusers; k++)
+                    {
+                        delays[c][k] += increments[c][k];
+                        const float delayed{lines_[c][k].Read(delays[c][k])};
+                        const float v{FlushDenormal(x + diffusion_ * delayed)};
+                        lines_[c][k].Write(v);
+                        x = delayed - diffusion_ * v;
+                    }
+                    out[c] = x;
+
+                    damp_[c] = FlushDenormal(damp_[c] + lpCoeff_ * (x - damp_[c]));
+                    loops_[c].Write(damp_[c]);
+                }
+                outLeft[i] = out[0];
+                outRight[i] = out[1];
+            }
+        }
+
+    private:
+        float OnePoleCoeff(float freq) const
+        {
+            return 1.f - expf(-TWOPI_F * freq / sampleRate_);
+        }
+
+        MaskedDelayLine<kDiffuserLineSize> lines_[2][kDiffusers];
+        MaskedDelayLine<kLoopLineSize> loops_[2];
+        float baseDelays_[2][kDiffusers];
+        float delays_[2][kDiffusers];
+        float loopDelays_[2];
+        float highShelf_[2];
+        float lowShelf_[2];
+        float damp_[2];
+
+        float sampleRate_;
+        float highShelfCoeff_;
+        float lowShelfCoeff_;
+        float hfGain_;
+        float lfGain_;
+        float feedback_;
+        float lpCoeff_;
+        float diffusion_;
+        float phase_;
+        float lfoIncrement_;
+        float lfoDepth_;
+    };
+}
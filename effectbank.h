@@ -1,47 +1,27 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+
 #include "Filters/svf.h"
 #include "Effects/reverbsc.h"
-#include "Utility/delayline.h"
 #include "Utility/dsp.h"
 
+#include "arena.h"
+#include "clockeddelay.h"
 #include "commons.h"
+#include "delaylines.h"
+#include "diffuser.h"
+#include "profiler.h"
+#include "ramp.h"
 #include "resonator.h"
+#include "saturator.h"
+#include "tables.h"
 
 namespace orchard
 {
     using namespace daisysp;
 
-    ReverbSc DSY_SDRAM_BSS reverb;
-    DelayLine<float, MAX_DELAY> DSY_SDRAM_BSS leftDelay_Line;
-    DelayLine<float, MAX_DELAY> DSY_SDRAM_BSS rightDelay_Line;
-
-    DelayLine<float, MAX_DELAY> DSY_SDRAM_BSS leftResoPoleDelayLine[3];
-    DelayLine<float, MAX_DELAY> DSY_SDRAM_BSS rightResoPoleDelayLine[3];
-
-    struct delay
-    {
-        DelayLine<float, MAX_DELAY> *del;
-        float currentDelay;
-        float delayTarget;
-
-        void Reset()
-        {
-            del->Reset();
-        }
-
-        float Process(float feedback, float in)
-        {
-            fonepole(currentDelay, delayTarget, .0002f);
-            del->SetDelay(currentDelay);
-
-            float read = del->Read();
-            del->Write((feedback * read) + in);
-
-            return read;
-        }
-    };
-
     struct EffectConf
     {
         bool active;
@@ -56,192 +36,859 @@ namespace orchard
         BP,
     };
 
+    constexpr int kResonatorPoles{3};
+
+    // Time for the filter to ring down, and longest feedback loop of the
+    // reverbs, in seconds. They bound the tails of the stages that sleep.
+    constexpr float kFilterTail{0.1f};
+    constexpr float kReverbLoopTime{0.1f};
+
+    // Highest reverb feedback, with its modulation.
+    constexpr float kMaxReverbFeedback{0.98f};
+
+    // Cutoff of the delay damping drawn by Randomize, in Hz, the octaves
+    // between the two are drawn evenly.
+    constexpr float kMinDelayDamp{1000.f};
+    constexpr float kMaxDelayDamp{12000.f};
+
+    enum class ReverbType
+    {
+        SC,
+        DIFFUSER,
+    };
+
+    // A complete random patch for the bank, see GeneratorPatch.
+    struct EffectPatch
+    {
+        EffectConf conf[4];
+        FilterType filterType;
+        float filterPitch;
+        float filterRes;
+        float filterDrive;
+        SaturatorCurve saturatorCurve;
+        float saturatorDrive;
+        float resoDecay;
+        float resoDetune;
+        float resoReso;
+        float resoPitches[kResonatorPoles];
+        float resoDamp;
+        // Free times in samples, and divisions of the clock.
+        float leftDelayTarget;
+        float rightDelayTarget;
+        int leftDelayDivision;
+        int rightDelayDivision;
+        float delayDamp;
+        float reverbFeedback;
+        float reverbLpFreq;
+        // Diffuser reverb only.
+        float reverbHfDamp;
+        float reverbLfDamp;
+        float reverbDiffusion;
+        float reverbLfoFreq;
+        float reverbLfoDepth;
+    };
+
     class EffectBank
     {
     public:
         EffectBank() {}
         ~EffectBank() {}
 
-        void Init(float sampleRate)
+        // The large buffers (the reverb, delay lines) are taken from arena,
+        // sized for sampleRate. Returns false if they don't fit, the bank must
+        // not be used then. The diffuser reverb is much cheaper than ReverbSc,
+        // only the selected one is allocated.
+        bool Init(float sampleRate, Arena &arena, ReverbType reverbType = ReverbType::SC)
         {
             sampleRate_ = sampleRate;
+            reverbType_ = reverbType;
+            const size_t used{arena.Used()};
 
             leftFilter_.Init(sampleRate_);
             rightFilter_.Init(sampleRate_);
 
-            for (int i = 0; i < 3; i++)
+            resonator_.Init(sampleRate_);
+            for (int i = 0; i < kResonatorPoles; i++)
+            {
+                leftPoleLines_[i].Init();
+                rightPoleLines_[i].Init();
+                resonator_.AddPole(&leftPoleLines_[i], &rightPoleLines_[i]);
+            }
+
+            if (!delay_.Init(sampleRate_, arena))
             {
-                leftResoPoleDelayLine[i].Init();
-                rightResoPoleDelayLine[i].Init();
+                return false;
             }
-            resonator_.Init(sampleRate_);
-            resonator_.AddPole(&leftResoPoleDelayLine[0], &rightResoPoleDelayLine[0]);
-            resonator_.AddPole(&leftResoPoleDelayLine[1], &rightResoPoleDelayLine[1]);
-            resonator_.AddPole(&leftResoPoleDelayLine[2], &rightResoPoleDelayLine[2]);
 
-            leftDelay_Line.Init();
-            rightDelay_Line.Init();
-            leftDelay_.del = &leftDelay_Line;
-            rightDelay_.del = &rightDelay_Line;
+            if (ReverbType::SC == reverbType_)
+            {
+                reverb_ = arena.New<ReverbSc>();
+                if (!reverb_)
+                {
+                    return false;
+                }
+                reverb_->Init(sampleRate_);
+            }
+            else
+            {
+                diffuser_ = arena.New<DiffuserReverb>();
+                if (!diffuser_)
+                {
+                    return false;
+                }
+                diffuser_->Init(sampleRate_);
+            }
+            memory_ = arena.Used() - used;
+
+            filterPitch_.Init(sampleRate_, 0.05f, RampShape::EXPONENTIAL);
+            filterRes_.Init(sampleRate_, 0.05f);
+            filterDrive_.Init(sampleRate_, 0.05f);
+            saturator_.Init(sampleRate_);
+            saturatorDrive_.Init(sampleRate_, 0.05f);
+            reverbFeedback_.Init(sampleRate_, 0.1f);
+            reverbLpFreq_.Init(sampleRate_, 0.1f);
+            for (int i = 0; i < 4; i++)
+            {
+                wet_[i].Init(sampleRate_, 0.05f);
+                sleep_[i] = {0, false};
+            }
 
-            reverb.Init(sampleRate_);
+            return true;
         }
 
-        void Randomize()
+        // Level of the clock input, sampled once per block. On its rising
+        // edges the delay times follow the clock, see ClockedDelay.
+        void SetClock(bool high)
+        {
+            if (high && !clockHigh_)
+            {
+                delay_.Tick();
+            }
+            clockHigh_ = high;
+        }
+
+        // Modulation set once per block and reached at the end of the next
+        // one, see BlockRamp: the filter cutoff in semitones, the resonator
+        // damp in octaves and the reverb size as an offset of its feedback.
+        void SetCutoffModulation(float semitones)
+        {
+            cutoffMod_.SetTarget(semitones);
+        }
+
+        void SetDampModulation(float octaves)
+        {
+            dampMod_.SetTarget(octaves);
+        }
+
+        void SetSizeModulation(float feedback)
+        {
+            sizeMod_.SetTarget(feedback);
+        }
+
+        // Oversampling of the saturator after the filter, 1, 2 or 4.
+        void SetOversampling(int factor)
+        {
+            saturator_.SetOversampling(factor);
+        }
+
+        // Stages sleep on silence by default, see ProcessBlock. Without
+        // sleeping they keep processing their decaying tails, as when
+        // measuring their cost on silence.
+        void SetSleep(bool enabled)
+        {
+            sleepEnabled_ = enabled;
+        }
+
+        // Bytes taken from the arena by Init.
+        size_t Memory() const
+        {
+            return memory_;
+        }
+
+        // See GeneratorBank::Seed, the banks use different streams of the
+        // same seed.
+        void Seed(uint32_t seed)
+        {
+            random_.Seed(seed, 1);
+        }
+
+        uint32_t State() const
+        {
+            return random_.State();
+        }
+
+        void Restore(uint32_t state)
+        {
+            random_.SetState(state);
+        }
+
+        // Fills patch with random values, the bank itself is not touched.
+        void Randomize(EffectPatch &patch)
         {
             // Filter.
-            conf_[0].active = true; //1 == std::rand() % 2;
-            if (conf_[0].active)
+            patch.conf[0].active = true; //random_.Chance(2);
+            if (patch.conf[0].active)
             {
-                conf_[0].dryWet = RandomFloat(0.f, 1.f);
-                filterType_ = static_cast<FilterType>(std::rand() % 3);
-                int pitch;
-                switch (filterType_)
+                patch.conf[0].dryWet = random_.Float();
+                patch.filterType = static_cast<FilterType>(random_.Int(3));
+                switch (patch.filterType)
                 {
                 case FilterType::HP:
-                    pitch = RandomPitch(Range::HIGH);
+                    patch.filterPitch = random_.Pitch(Range::HIGH);
                     break;
 
                 case FilterType::LP:
-                    pitch = RandomPitch(Range::LOW);
+                    patch.filterPitch = random_.Pitch(Range::LOW);
                     break;
 
                 case FilterType::BP:
-                    pitch = RandomPitch(Range::FULL);
+                    patch.filterPitch = random_.Pitch(Range::FULL);
                     break;
 
                 default:
                     break;
                 }
-                float freq = mtof(pitch);
-                float res{RandomFloat(0.f, 1.f)};
-                float drive{RandomFloat(0.f, 1.f)};
-                leftFilter_.SetFreq(freq);
-                leftFilter_.SetRes(res);
-                leftFilter_.SetDrive(drive);
-                rightFilter_.SetFreq(freq);
-                rightFilter_.SetRes(res);
-                rightFilter_.SetDrive(drive);
+                patch.filterRes = random_.Float();
+                patch.filterDrive = random_.Float();
+            }
+
+            // Resonator.
+            patch.conf[1].active = true; //random_.Chance(2);
+            if (patch.conf[1].active)
+            {
+                patch.conf[1].dryWet = random_.Float();
+                patch.resoDecay = random_.Float(0.f, 0.4f);
+                patch.resoDetune = random_.Float(0.f, 0.1f);
+                patch.resoReso = random_.Float(0.f, 0.4f);
+                random_.FillPitches(patch.resoPitches, kResonatorPoles, Range::FULL);
+                patch.resoDamp = random_.Float(100.f, 5000.f);
+            }
+
+            // Reverb.
+            patch.conf[3].active = true; //random_.Chance(2);
+            if (patch.conf[3].active)
+            {
+                patch.conf[3].dryWet = random_.Float();
+                patch.reverbFeedback = random_.Float(0.f, 0.9f);
+                patch.reverbLpFreq = random_.Float(0.f, 5000.f);
+                if (ReverbType::DIFFUSER == reverbType_)
+                {
+                    patch.reverbHfDamp = random_.Float();
+                    patch.reverbLfDamp = random_.Float(0.f, 0.5f);
+                    patch.reverbDiffusion = random_.Float(0.3f, 0.8f);
+                    patch.reverbLfoFreq = random_.Float(0.05f, 2.f);
+                    patch.reverbLfoDepth = random_.Float();
+                }
+            }
+
+            // Saturator, after the filter.
+            if (patch.conf[0].active)
+            {
+                patch.saturatorCurve = static_cast<SaturatorCurve>(random_.Int(static_cast<uint32_t>(SaturatorCurve::LAST_CURVE)));
+                patch.saturatorDrive = random_.Float();
+            }
+
+            // Delay, drawn last so that the other stages keep their values
+            // for a given seed.
+            patch.conf[2].active = true; //random_.Chance(2);
+            if (patch.conf[2].active)
+            {
+                patch.conf[2].dryWet = random_.Float();
+                patch.conf[2].param1 = random_.Float(0.f, 0.9f);
+                patch.leftDelayTarget = random_.Float(sampleRate_ * .05f, sampleRate_ * kMaxDelayTime);
+                patch.rightDelayTarget = random_.Float(sampleRate_ * .05f, sampleRate_ * kMaxDelayTime);
+                patch.leftDelayDivision = random_.Int(kDelayDivisions);
+                patch.rightDelayDivision = random_.Int(kDelayDivisions);
+                patch.delayDamp = kMinDelayDamp * Exp2(random_.Float() * std::log2(kMaxDelayDamp / kMinDelayDamp));
+            }
+        }
+
+        // Sets a patch made by Randomize, the continuous parameters glide to
+        // the new values. Only the stages active in the patch are changed.
+        void Apply(const EffectPatch &patch)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                conf_[i].active = patch.conf[i].active;
+                if (conf_[i].active)
+                {
+                    conf_[i].dryWet = patch.conf[i].dryWet;
+                    conf_[i].param1 = patch.conf[i].param1;
+                    wet_[i].SetTarget(conf_[i].dryWet);
+                }
+            }
+
+            // Filter.
+            if (conf_[0].active)
+            {
+                filterType_ = patch.filterType;
+                filterPitch_.SetTarget(patch.filterPitch);
+                filterRes_.SetTarget(patch.filterRes);
+                filterDrive_.SetTarget(patch.filterDrive);
+                saturator_.SetCurve(patch.saturatorCurve);
+                saturatorDrive_.SetTarget(patch.saturatorDrive);
+                if (filterPitch_.IsDone())
+                {
+                    // First patch, no ramp.
+                    SetFilterFreq();
+                    SetFilterRes();
+                    SetFilterDrive();
+                    saturator_.SetDrive(saturatorDrive_.Value());
+                }
             }
 
             // Resonator.
-            conf_[1].active = true; //1 == std::rand() % 2;
             if (conf_[1].active)
             {
-                conf_[1].dryWet = RandomFloat(0.f, 1.f);
-                resonator_.SetDecay(RandomFloat(0.f, 0.4f));
-                resonator_.SetDetune(RandomFloat(0.f, 0.1f));
-                resonator_.SetReso(RandomFloat(0.f, 0.4f));
-                resonator_.SetPitch(0, RandomPitch(Range::FULL));
-                resonator_.SetPitch(1, RandomPitch(Range::FULL));
-                resonator_.SetPitch(2, RandomPitch(Range::FULL));
-                resonator_.SetDamp(RandomFloat(100.f, 5000.f));
-                /*
-            conf_[1].dryWet = 1.f;
-            resonator_.SetDecay(0.4f);
-            resonator_.SetDetune(0.f);
-            resonator_.SetReso(0.4f);
-            resonator_.SetPitch(0, 60.f);
-            resonator_.SetPitch(1, 60.f);
-            resonator_.SetPitch(2, 60.f);
-            resonator_.SetDamp(500.f);
-            */
-            }
-
-            // Delay.
-            conf_[2].active = false; //1 == std::rand() % 2;
+                resonator_.SetDecay(patch.resoDecay);
+                resonator_.SetDetune(patch.resoDetune);
+                resonator_.SetReso(patch.resoReso);
+                for (int i = 0; i < kResonatorPoles; i++)
+                {
+                    resonator_.SetPitch(i, patch.resoPitches[i]);
+                }
+                resonator_.SetDamp(patch.resoDamp);
+            }
+
+            // Delay, the lines crossfade to the new times instead of being
+            // cleared.
             if (conf_[2].active)
             {
-                leftDelay_.Reset();
-                rightDelay_.Reset();
-                conf_[2].dryWet = RandomFloat(0.f, 1.f);
-                conf_[2].param1 = RandomFloat(0.f, 0.9f);
-                leftDelay_.delayTarget = RandomFloat(sampleRate_ * .05f, MAX_DELAY);
-                rightDelay_.delayTarget = RandomFloat(sampleRate_ * .05f, MAX_DELAY);
+                delay_.SetFeedback(conf_[2].param1);
+                delay_.SetDamp(patch.delayDamp);
+                delay_.SetTimes(patch.leftDelayTarget, patch.rightDelayTarget);
+                delay_.SetDivisions(patch.leftDelayDivision, patch.rightDelayDivision);
             }
 
             // Reverb.
-            conf_[3].active = true; //1 == std::rand() % 2;
             if (conf_[3].active)
             {
-                conf_[3].dryWet = RandomFloat(0.f, 1.f);
-                float fb{RandomFloat(0.f, 0.9f)};
-                reverb.SetFeedback(fb);
-                reverb.SetLpFreq(RandomFloat(0.f, 5000.f));
+                reverbFeedback_.SetTarget(patch.reverbFeedback);
+                reverbLpFreq_.SetTarget(patch.reverbLpFreq);
+                if (reverbFeedback_.IsDone())
+                {
+                    // First patch, no ramp.
+                    SetReverbFeedback();
+                    SetReverbLpFreq();
+                }
+                if (ReverbType::DIFFUSER == reverbType_)
+                {
+                    diffuser_->SetHfDamp(patch.reverbHfDamp);
+                    diffuser_->SetLfDamp(patch.reverbLfDamp);
+                    diffuser_->SetDiffusion(patch.reverbDiffusion);
+                    diffuser_->SetLfoFreq(patch.reverbLfoFreq);
+                    diffuser_->SetLfoDepth(patch.reverbLfoDepth);
+                }
             }
         }
 
         void Process(float &left, float &right)
         {
-            // Effects.
-            float leftW{0.f};
-            float rightW{0.f};
+            ProcessBlock(&left, &right, 1);
+        }
 
-            // Filter.
+        // Processes n samples in place. The active stages and the filter type
+        // are checked once for the whole block. A stage sleeps, passing its
+        // input through, once the input has been silent for longer than its
+        // tail, and wakes up on the first block with some input.
+        void ProcessBlock(float *left, float *right, size_t n)
+        {
             if (conf_[0].active)
             {
-                leftFilter_.Process(left);
-                rightFilter_.Process(right);
-                switch (filterType_)
+                ProcessFilter(left, right, n);
+            }
+            if (conf_[1].active)
+            {
+                ProcessResonator(left, right, n);
+            }
+            if (conf_[2].active)
+            {
+                ProcessDelay(left, right, n);
+            }
+            if (conf_[3].active)
+            {
+                ProcessReverb(left, right, n);
+            }
+
+            AdvanceModulation();
+
+            PROFILE_ASLEEP(Stage::FILTER, Asleep(0));
+            PROFILE_ASLEEP(Stage::SATURATOR, Asleep(0));
+            PROFILE_ASLEEP(Stage::RESONATOR, Asleep(1));
+            PROFILE_ASLEEP(Stage::DELAY, Asleep(2));
+            PROFILE_ASLEEP(Stage::REVERB, Asleep(3));
+        }
+
+        // Whether the given stage (0 filter, 1 resonator, 2 delay, 3 reverb)
+        // skipped the last block.
+        bool Asleep(int stage) const
+        {
+            return conf_[stage].active && sleep_[stage].asleep;
+        }
+
+        static constexpr size_t kRamps{10};
+
+        // See GeneratorBank::Ramps.
+        size_t Ramps(const Ramp *ramps[kRamps]) const
+        {
+            const Ramp *params[]{&filterPitch_, &filterRes_, &filterDrive_, &saturatorDrive_, &reverbFeedback_, &reverbLpFreq_};
+            size_t count{0};
+            for (const Ramp *ramp : params)
+            {
+                ramps[count++] = ramp;
+            }
+            for (const Ramp &wet : wet_)
+            {
+                ramps[count++] = &wet;
+            }
+
+            return count;
+        }
+
+    private:
+        // Input silence of a stage, in samples, and whether it is sleeping.
+        struct StageSleep
+        {
+            size_t silent;
+            bool asleep;
+        };
+
+        // Longest tail counted for a stage, so that the silence count doesn't
+        // wrap.
+        static constexpr size_t kMaxSilence{1u << 30};
+
+        void ProcessFilter(float *left, float *right, size_t n)
+        {
+            float leftW[kMaxBlockSize];
+            float rightW[kMaxBlockSize];
+            {
+                PROFILE_STAGE(Stage::FILTER);
+                UpdateFilter(n);
+                if (!Wake(0, left, right, n))
                 {
-                case FilterType::LP:
-                    leftW = leftFilter_.Low();
-                    rightW = rightFilter_.Low();
-                    break;
+                    return;
+                }
+                if (cutoffMod_.IsDone())
+                {
+                    FilterSpan(left, right, leftW, rightW, n);
+                }
+                else
+                {
+                    for (size_t start = 0; start < n; start += kSubBlockSize)
+                    {
+                        const size_t end{std::min(start + kSubBlockSize, n)};
+                        SetFilterFreq(cutoffMod_.At(end, n));
+                        FilterSpan(left + start, right + start, leftW + start, rightW + start, end - start);
+                    }
+                }
+            }
+            {
+                PROFILE_STAGE(Stage::SATURATOR);
+                saturator_.ProcessBlock(leftW, rightW, n);
+                saturator_.DelayDry(left, right, n);
+            }
+            PROFILE_STAGE(Stage::FILTER);
+            float wet;
+            float wetIncrement;
+            WetBlock(0, n, wet, wetIncrement);
+            for (size_t i = 0; i < n; i++)
+            {
+                wet += wetIncrement;
+                const float dry{1.0f - wet};
+                left[i] = wet * leftW[i] * .3f + dry * left[i];
+                right[i] = wet * rightW[i] * .3f + dry * right[i];
+            }
+            Settle(0, left, right, n);
+        }
 
-                case FilterType::HP:
-                    leftW = leftFilter_.High();
-                    rightW = rightFilter_.High();
-                    break;
+        void ProcessResonator(float *left, float *right, size_t n)
+        {
+            PROFILE_STAGE(Stage::RESONATOR);
+            if (!Wake(1, left, right, n))
+            {
+                resonator_.Idle(n);
 
-                case FilterType::BP:
-                    leftW = leftFilter_.Band();
-                    rightW = rightFilter_.Band();
-                    break;
+                return;
+            }
+            float leftW[kMaxBlockSize];
+            float rightW[kMaxBlockSize];
+            std::copy(left, left + n, leftW);
+            std::copy(right, right + n, rightW);
+            if (dampMod_.IsDone())
+            {
+                resonator_.ProcessBlock(leftW, rightW, n);
+            }
+            else
+            {
+                for (size_t start = 0; start < n; start += kSubBlockSize)
+                {
+                    const size_t end{std::min(start + kSubBlockSize, n)};
+                    resonator_.SetDampScale(Exp2(dampMod_.At(end, n)));
+                    resonator_.ProcessBlock(leftW + start, rightW + start, end - start);
+                }
+            }
+            float wet;
+            float wetIncrement;
+            WetBlock(1, n, wet, wetIncrement);
+            for (size_t i = 0; i < n; i++)
+            {
+                wet += wetIncrement;
+                const float dry{1.0f - wet};
+                left[i] = wet * SoftClip(leftW[i]) * .3f + dry * left[i];
+                right[i] = wet * SoftClip(rightW[i]) * .3f + dry * right[i];
+            }
+            Settle(1, left, right, n);
+        }
 
-                default:
-                    break;
+        void ProcessDelay(float *left, float *right, size_t n)
+        {
+            PROFILE_STAGE(Stage::DELAY);
+            if (!Wake(2, left, right, n))
+            {
+                delay_.Idle(n);
+
+                return;
+            }
+            float leftW[kMaxBlockSize];
+            float rightW[kMaxBlockSize];
+            delay_.ProcessBlock(left, right, leftW, rightW, n);
+            float wet;
+            float wetIncrement;
+            WetBlock(2, n, wet, wetIncrement);
+            for (size_t i = 0; i < n; i++)
+            {
+                wet += wetIncrement;
+                const float dry{1.0f - wet};
+                left[i] = wet * leftW[i] * .3f + dry * left[i];
+                right[i] = wet * rightW[i] * .3f + dry * right[i];
+            }
+            Settle(2, left, right, n);
+        }
+
+        void ProcessReverb(float *left, float *right, size_t n)
+        {
+            PROFILE_STAGE(Stage::REVERB);
+            UpdateReverb(n);
+            if (!Wake(3, left, right, n))
+            {
+                return;
+            }
+            float leftW[kMaxBlockSize];
+            float rightW[kMaxBlockSize];
+            if (sizeMod_.IsDone())
+            {
+                ReverbSpan(left, right, leftW, rightW, n);
+            }
+            else
+            {
+                for (size_t start = 0; start < n; start += kSubBlockSize)
+                {
+                    const size_t end{std::min(start + kSubBlockSize, n)};
+                    SetReverbFeedback(sizeMod_.At(end, n));
+                    ReverbSpan(left + start, right + start, leftW + start, rightW + start, end - start);
                 }
-                left = conf_[0].dryWet * leftW * .3f + (1.0f - conf_[0].dryWet) * left;
-                right = conf_[0].dryWet * rightW * .3f + (1.0f - conf_[0].dryWet) * right;
             }
+            float wet;
+            float wetIncrement;
+            WetBlock(3, n, wet, wetIncrement);
+            for (size_t i = 0; i < n; i++)
+            {
+                wet += wetIncrement;
+                const float dry{1.0f - wet};
+                left[i] = wet * leftW[i] * .3f + dry * left[i];
+                right[i] = wet * rightW[i] * .3f + dry * right[i];
+            }
+            Settle(3, left, right, n);
+        }
 
-            // Resonator.
-            if (conf_[1].active)
+        // Counts the silent input of the stage, returns false if it sleeps
+        // through the block. Only the wet ramp moves then, the stage output
+        // is already below kSilence and its input goes through untouched.
+        bool Wake(int stage, const float *left, const float *right, size_t n)
+        {
+            StageSleep &sleep{sleep_[stage]};
+            if (Peak(left, right, n) >= kSilence)
             {
-                leftW = left;
-                rightW = right;
-                resonator_.Process(leftW, rightW);
-                left = conf_[1].dryWet * SoftClip(leftW) * .3f + (1.0f - conf_[1].dryWet) * left;
-                right = conf_[1].dryWet * SoftClip(rightW) * .3f + (1.0f - conf_[1].dryWet) * right;
+                sleep.silent = 0;
+                sleep.asleep = false;
+
+                return true;
+            }
+            sleep.silent = std::min(sleep.silent + n, kMaxSilence);
+            sleep.asleep = sleep.asleep && sleepEnabled_;
+            if (sleep.asleep)
+            {
+                wet_[stage].Process(n);
             }
 
-            // Delay.
-            if (conf_[2].active)
+            return !sleep.asleep;
+        }
+
+        // After a block with silent input, puts the stage to sleep if its
+        // tail is over and its output is silent as well.
+        void Settle(int stage, const float *left, const float *right, size_t n)
+        {
+            StageSleep &sleep{sleep_[stage]};
+            if (sleepEnabled_ && sleep.silent > 0 && sleep.silent >= Tail(stage) && Peak(left, right, n) < kSilence)
             {
-                leftW = leftDelay_.Process(conf_[2].param1, left);
-                rightW = rightDelay_.Process(conf_[2].param1, right);
-                left = conf_[2].dryWet * leftW * .3f + (1.0f - conf_[2].dryWet) * left;
-                right = conf_[2].dryWet * rightW * .3f + (1.0f - conf_[2].dryWet) * right;
+                sleep.asleep = true;
             }
+        }
 
-            // Reverb.
-            if (conf_[3].active)
+        // Samples for the feedback of the stage to decay below kSilence.
+        float Tail(int stage) const
+        {
+            switch (stage)
             {
-                reverb.Process(left, right, &leftW, &rightW);
-                left = conf_[3].dryWet * leftW * .3f + (1.0f - conf_[3].dryWet) * left;
-                right = conf_[3].dryWet * rightW * .3f + (1.0f - conf_[3].dryWet) * right;
+            case 0:
+                return kFilterTail * sampleRate_;
+
+            case 1:
+                return resonator_.Tail(kSilence);
+
+            case 2:
+                return FeedbackTail(delay_.Longest(), conf_[2].param1, kSilence);
+
+            default:
+                return FeedbackTail(kReverbLoopTime * sampleRate_, std::max(reverbFeedback_.Value(), reverbFeedback_.Target()) + std::max(sizeMod_.Value(), 0.f), kSilence);
+            }
+        }
+
+        static inline float Peak(const float *left, const float *right, size_t n)
+        {
+            float peak{0.f};
+            for (size_t i = 0; i < n; i++)
+            {
+                peak = std::max(peak, std::max(std::fabs(left[i]), std::fabs(right[i])));
+            }
+
+            return peak;
+        }
+
+        template <FilterType type>
+        static inline float FilterOutput(Svf &filter)
+        {
+            switch (type)
+            {
+            case FilterType::LP:
+                return filter.Low();
+
+            case FilterType::HP:
+                return filter.High();
+
+            default:
+                return filter.Band();
+            }
+        }
+
+        // Moves the filter parameters n samples along their ramps, the
+        // coefficients are only recomputed while a ramp is running.
+        void UpdateFilter(size_t n)
+        {
+            if (!filterPitch_.IsDone())
+            {
+                filterPitch_.Process(n);
+                SetFilterFreq();
+            }
+            if (!filterRes_.IsDone())
+            {
+                filterRes_.Process(n);
+                SetFilterRes();
+            }
+            if (!filterDrive_.IsDone())
+            {
+                filterDrive_.Process(n);
+                SetFilterDrive();
+            }
+            if (!saturatorDrive_.IsDone())
+            {
+                saturator_.SetDrive(saturatorDrive_.Process(n));
+            }
+        }
+
+        void SetFilterFreq()
+        {
+            SetFilterFreq(cutoffMod_.Value());
+        }
+
+        void SetFilterFreq(float modulation)
+        {
+            float freq{Mtof(filterPitch_.Value() + modulation)};
+            leftFilter_.SetFreq(freq);
+            rightFilter_.SetFreq(freq);
+        }
+
+        void SetFilterRes()
+        {
+            leftFilter_.SetRes(filterRes_.Value());
+            rightFilter_.SetRes(filterRes_.Value());
+        }
+
+        void SetFilterDrive()
+        {
+            leftFilter_.SetDrive(filterDrive_.Value());
+            rightFilter_.SetDrive(filterDrive_.Value());
+        }
+
+        void UpdateReverb(size_t n)
+        {
+            if (!reverbFeedback_.IsDone())
+            {
+                reverbFeedback_.Process(n);
+                SetReverbFeedback();
+            }
+            if (!reverbLpFreq_.IsDone())
+            {
+                reverbLpFreq_.Process(n);
+                SetReverbLpFreq();
+            }
+        }
+
+        void SetReverbFeedback()
+        {
+            SetReverbFeedback(sizeMod_.Value());
+        }
+
+        void SetReverbFeedback(float modulation)
+        {
+            const float feedback{fclamp(reverbFeedback_.Value() + modulation, 0.f, kMaxReverbFeedback)};
+            if (ReverbType::SC == reverbType_)
+            {
+                reverb_->SetFeedback(feedback);
+            }
+            else
+            {
+                diffuser_->SetFeedback(feedback);
+            }
+        }
+
+        // Ends the block for the modulation. The stages that didn't process
+        // it, sleeping or off, take the values reached.
+        void AdvanceModulation()
+        {
+            if (!cutoffMod_.IsDone())
+            {
+                cutoffMod_.Advance();
+                if (!conf_[0].active || sleep_[0].asleep)
+                {
+                    SetFilterFreq();
+                }
+            }
+            if (!dampMod_.IsDone())
+            {
+                dampMod_.Advance();
+                if (!conf_[1].active || sleep_[1].asleep)
+                {
+                    resonator_.SetDampScale(Exp2(dampMod_.Value()));
+                }
+            }
+            if (!sizeMod_.IsDone())
+            {
+                sizeMod_.Advance();
+                if (!conf_[3].active || sleep_[3].asleep)
+                {
+                    SetReverbFeedback();
+                }
+            }
+        }
+
+        void SetReverbLpFreq()
+        {
+            if (ReverbType::SC == reverbType_)
+            {
+                reverb_->SetLpFreq(reverbLpFreq_.Value());
+            }
+            else
+            {
+                diffuser_->SetLpFreq(reverbLpFreq_.Value());
+            }
+        }
+
+        // Wet amount of the given stage at the start of the block and its
+        // per-sample increment, to be added before each sample.
+        inline void WetBlock(int stage, size_t n, float &wet, float &increment)
+        {
+            wet = wet_[stage].Value();
+            increment = (wet_[stage].Process(n) - wet) / n;
+        }
+
+        void FilterSpan(const float *left, const float *right, float *leftW, float *rightW, size_t n)
+        {
+            switch (filterType_)
+            {
+            case FilterType::LP:
+                FilterBlock<FilterType::LP>(left, right, leftW, rightW, n);
+                break;
+
+            case FilterType::HP:
+                FilterBlock<FilterType::HP>(left, right, leftW, rightW, n);
+                break;
+
+            case FilterType::BP:
+                FilterBlock<FilterType::BP>(left, right, leftW, rightW, n);
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        void ReverbSpan(const float *left, const float *right, float *leftW, float *rightW, size_t n)
+        {
+            if (ReverbType::SC == reverbType_)
+            {
+                for (size_t i = 0; i < n; i++)
+                {
+                    reverb_->Process(left[i], right[i], &leftW[i], &rightW[i]);
+                }
+            }
+            else
+            {
+                diffuser_->ProcessBlock(left, right, leftW, rightW, n);
+            }
+        }
+
+        template <FilterType type>
+        void FilterBlock(const float *left, const float *right, float *leftW, float *rightW, size_t n)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                leftFilter_.Process(left[i]);
+                rightFilter_.Process(right[i]);
+                leftW[i] = FilterOutput<type>(leftFilter_);
+                rightW[i] = FilterOutput<type>(rightFilter_);
             }
         }
 
-    private:
         Svf leftFilter_;
         Svf rightFilter_;
-        delay leftDelay_;
-        delay rightDelay_;
+        ClockedDelay delay_;
+        bool clockHigh_{false};
         Resonator resonator_;
+        // The pole lines are short, they stay in internal RAM with the bank.
+        PoleLine leftPoleLines_[kResonatorPoles];
+        PoleLine rightPoleLines_[kResonatorPoles];
+        ReverbType reverbType_{ReverbType::SC};
+        ReverbSc *reverb_{nullptr};
+        DiffuserReverb *diffuser_{nullptr};
+        size_t memory_{0};
         EffectConf conf_[4];
         FilterType filterType_;
+
+        Ramp filterPitch_;
+        Ramp filterRes_;
+        Ramp filterDrive_;
+        Saturator saturator_;
+        Ramp saturatorDrive_;
+        Ramp reverbFeedback_;
+        Ramp reverbLpFreq_;
+        Ramp wet_[4];
+        BlockRamp cutoffMod_;
+        BlockRamp dampMod_;
+        BlockRamp sizeMod_;
+        StageSleep sleep_[4]{};
+        bool sleepEnabled_{true};
+        Prng random_;
         float sampleRate_;
     };
 }
\ No newline at end of file
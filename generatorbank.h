@@ -1,9 +1,9 @@
 #pragma once
 
-#include "Synthesis/blosc.h"
-#include "Synthesis/oscillator.h"
-#include "Synthesis/variablesawosc.h"
-#include "Synthesis/variableshapeosc.h"
+#include <algorithm>
+#include <tuple>
+#include <type_traits>
+
 #include "Noise/whitenoise.h"
 #include "Filters/atone.h"
 #include "Filters/tone.h"
@@ -11,12 +11,238 @@
 #include "Utility/dsp.h"
 
 #include "commons.h"
+#include "oscillatorbank.h"
+#include "profiler.h"
+#include "quantizer.h"
+#include "ramp.h"
+#include "tables.h"
 
 namespace orchard
 {
     using namespace daisysp;
 
-    constexpr int kGenerators{9};
+    // Randomized parameters of a generator slot, their meaning depends on the
+    // slot type.
+    struct SlotPatch
+    {
+        float shape;
+        float pw;
+    };
+
+    // Generator slots. Every slot wraps one generator type behind the same
+    // interface (Init, SetFreq, SetCharacter, Randomize, Apply, ProcessBlock),
+    // kRange is the interval range used when randomizing its pitch. Randomize
+    // only fills a SlotPatch, Apply sets it on the generator. The pitched
+    // slots are voices of the bank's OscillatorBank.
+
+    template <Range range>
+    struct SineSlot
+    {
+        static constexpr Range kRange{range};
+
+        void Init(float sampleRate, OscillatorBank &oscillators)
+        {
+            bank = &oscillators;
+            voice = bank->AddVoice(Waveform::SINE);
+        }
+
+        void SetFreq(float freq)
+        {
+            bank->SetFreq(voice, freq);
+        }
+
+        void SetCharacter(float character) {}
+
+        static void Randomize(Prng &random, SlotPatch &patch) {}
+
+        void Apply(const SlotPatch &patch) {}
+
+        inline void ProcessBlock(float *out, size_t n)
+        {
+            bank->ProcessBlock(voice, out, n);
+        }
+
+        OscillatorBank *bank;
+        int voice;
+    };
+
+    template <Range range>
+    struct BipolarRampSlot
+    {
+        static constexpr Range kRange{range};
+
+        void Init(float sampleRate, OscillatorBank &oscillators)
+        {
+            bank = &oscillators;
+            voice = bank->AddVoice(Waveform::SAW);
+        }
+
+        void SetFreq(float freq)
+        {
+            bank->SetFreq(voice, freq);
+        }
+
+        void SetCharacter(float character)
+        {
+            bank->SetShape(voice, character);
+            bank->SetPw(voice, 1.f - character);
+        }
+
+        static void Randomize(Prng &random, SlotPatch &patch)
+        {
+            patch.shape = random.Float(0.f, 1.f);
+            patch.pw = random.Float(-1.f, 1.f);
+        }
+
+        void Apply(const SlotPatch &patch)
+        {
+            bank->SetShape(voice, patch.shape);
+            bank->SetPw(voice, patch.pw);
+        }
+
+        inline void ProcessBlock(float *out, size_t n)
+        {
+            bank->ProcessBlock(voice, out, n);
+        }
+
+        OscillatorBank *bank;
+        int voice;
+    };
+
+    template <Waveform waveform, Range range>
+    struct BlSlot
+    {
+        static constexpr Range kRange{range};
+
+        void Init(float sampleRate, OscillatorBank &oscillators)
+        {
+            bank = &oscillators;
+            voice = bank->AddVoice(waveform);
+        }
+
+        void SetFreq(float freq)
+        {
+            bank->SetFreq(voice, freq);
+        }
+
+        void SetCharacter(float character)
+        {
+            bank->SetPw(voice, character);
+        }
+
+        static void Randomize(Prng &random, SlotPatch &patch)
+        {
+            patch.pw = random.Float(-1.f, 1.f);
+        }
+
+        void Apply(const SlotPatch &patch)
+        {
+            bank->SetPw(voice, patch.pw);
+        }
+
+        inline void ProcessBlock(float *out, size_t n)
+        {
+            bank->ProcessBlock(voice, out, n);
+        }
+
+        OscillatorBank *bank;
+        int voice;
+    };
+
+    // White noise filtered by an high and a low shelf in series, the pitch sets
+    // their transition frequency.
+    template <Range range>
+    struct NoiseSlot
+    {
+        static constexpr Range kRange{range};
+
+        void Init(float sampleRate, OscillatorBank &oscillators)
+        {
+            noise.Init();
+            noise.SetAmp(1.f);
+            filterHP.Init(sampleRate);
+            filterLP.Init(sampleRate);
+        }
+
+        void SetFreq(float freq)
+        {
+            filterHP.SetFreq(freq);
+            filterLP.SetFreq(freq);
+        }
+
+        void SetCharacter(float character) {}
+
+        static void Randomize(Prng &random, SlotPatch &patch)
+        {
+            patch.shape = random.Float(1.f, 2.f);
+        }
+
+        void Apply(const SlotPatch &patch)
+        {
+            character = patch.shape;
+        }
+
+        inline void ProcessBlock(float *out, size_t n)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                float sig{noise.Process()};
+                sig = character * sig;
+                sig = filterHP.Process(sig);
+                sig = character * sig;
+                out[i] = SoftClip(filterLP.Process(sig));
+            }
+        }
+
+        WhiteNoise noise;
+        ATone filterHP;
+        Tone filterLP;
+        float character{1.f};
+    };
+
+    // The generators in slot order, adding a generator means adding its slot
+    // type here.
+    using Generators = std::tuple<
+        SineSlot<Range::HIGH>,                     // 0 = hOsc1
+        SineSlot<Range::LOW>,                      // 1 = lOsc1
+        BipolarRampSlot<Range::HIGH>,              // 2 = hOsc2
+        BipolarRampSlot<Range::LOW>,               // 3 = lOsc2
+        BlSlot<Waveform::TRIANGLE, Range::HIGH>,   // 4 = hOsc3
+        BlSlot<Waveform::TRIANGLE, Range::LOW>,    // 5 = lOsc3
+        BlSlot<Waveform::PULSE, Range::HIGH>,      // 6 = hOsc4
+        BlSlot<Waveform::PULSE, Range::LOW>,       // 7 = lOsc4
+        NoiseSlot<Range::FULL>>;                   // 8 = noise
+
+    constexpr int kGenerators{std::tuple_size<Generators>::value};
+
+    enum class PanLaw
+    {
+        LINEAR,
+        CONSTANT_POWER,
+    };
+
+    // Left and right gains for pan in [0, 1], 0 is hard left. The constant
+    // power law reads kPanTable.
+    inline void PanGains(PanLaw law, float pan, float &left, float &right)
+    {
+        pan = fclamp(pan, 0.f, 1.f);
+        if (PanLaw::LINEAR == law)
+        {
+            left = 1.f - pan;
+            right = pan;
+
+            return;
+        }
+
+        float index{pan * kPanTableSize};
+        int i{std::min(static_cast<int>(index), kPanTableSize - 1)};
+        float frac{index - i};
+        const float *table{kPanTable.values};
+        right = table[i] + (table[i + 1] - table[i]) * frac;
+        // cos(x) = sin(pi/2 - x), read the table backwards.
+        int j{kPanTableSize - i};
+        left = table[j] + (table[j - 1] - table[j]) * frac;
+    }
 
     struct GeneratorConf
     {
@@ -28,6 +254,26 @@ namespace orchard
         float character;
         int ringSource;
         float ringAmt;
+        // Volume and pan as left and right gains, see GeneratorBank::UpdateGains.
+        float leftGain;
+        float rightGain;
+    };
+
+    struct EnvelopePatch
+    {
+        float attack;
+        float decay;
+        float sustain;
+        float release;
+    };
+
+    // A complete random patch for the bank. It is computed outside of the
+    // audio callback and applied at a block boundary.
+    struct GeneratorPatch
+    {
+        GeneratorConf conf[kGenerators];
+        EnvelopePatch envelopes[kGenerators];
+        SlotPatch slots[kGenerators];
     };
 
     class GeneratorBank
@@ -39,129 +285,203 @@ namespace orchard
 
         void Init(float sampleRate)
         {
-            hOsc1_.Init(sampleRate);
-            hOsc1_.SetWaveform(Oscillator::WAVE_SIN);
-            hOsc1_.SetAmp(1.f);
+            oscillators_.Init(sampleRate);
+            ForEachGenerator([this, sampleRate](auto &generator, int i) {
+                generator.Init(sampleRate, oscillators_);
+            });
 
-            hOsc2_.Init(sampleRate);
+            for (int i = 0; i < kGenerators; i++)
+            {
+                envelopes_[i].Init(sampleRate);
+                conf_[i].ringSource = -1;
+                volumes_[i].Init(sampleRate, 0.02f);
+                pans_[i].Init(sampleRate, 0.02f);
+                pitches_[i].Init(sampleRate, 0.005f, RampShape::EXPONENTIAL);
+            }
 
-            hOsc3_.Init(sampleRate);
-            hOsc3_.SetWaveform(BlOsc::WAVE_TRIANGLE);
-            hOsc3_.SetAmp(1.f);
+            quantizer_.Init();
+        }
 
-            hOsc4_.Init(sampleRate);
-            hOsc4_.SetWaveform(BlOsc::WAVE_SQUARE);
-            hOsc4_.SetAmp(1.f);
+        // The base pitch is quantized, the frequencies only change when it
+        // moves to another note of the scale.
+        void SetPitch(float pitch)
+        {
+            basePitch_ = fclamp(pitch, 0, 127);
+            const int note{quantizer_.Note(basePitch_)};
+            if (note != baseNote_)
+            {
+                baseNote_ = note;
+                SetFrequencies();
+            }
+        }
 
-            lOsc1_.Init(sampleRate);
-            lOsc1_.SetWaveform(Oscillator::WAVE_SIN);
-            lOsc1_.SetAmp(1.f);
+        void SetScale(Scale scale)
+        {
+            if (quantizer_.SetScale(scale))
+            {
+                baseNote_ = quantizer_.Note(basePitch_);
+                SetFrequencies();
+            }
+        }
 
-            lOsc2_.Init(sampleRate);
+        // Root of the scale, 0 is C.
+        void SetRoot(int root)
+        {
+            if (quantizer_.SetRoot(root))
+            {
+                baseNote_ = quantizer_.Note(basePitch_);
+                SetFrequencies();
+            }
+        }
 
-            lOsc3_.Init(sampleRate);
-            lOsc3_.SetWaveform(BlOsc::WAVE_TRIANGLE);
-            lOsc3_.SetAmp(1.f);
+        void SetCharacter(float character)
+        {
+            ForEachGenerator([character](auto &generator, int i) {
+                generator.SetCharacter(character);
+            });
+        }
 
-            lOsc4_.Init(sampleRate);
-            lOsc4_.SetWaveform(BlOsc::WAVE_SQUARE);
-            lOsc4_.SetAmp(1.f);
+        // Volume, pan and pitch glide to the new values, the stereo gains and
+        // the frequencies are updated once per block while they move.
+        void SetVolume(int generator, float volume)
+        {
+            conf_[generator].volume = volume;
+            volumes_[generator].SetTarget(volume);
+            UpdateGains(generator);
+        }
+
+        void SetPan(int generator, float pan)
+        {
+            conf_[generator].pan = pan;
+            pans_[generator].SetTarget(pan);
+            UpdateGains(generator);
+        }
 
-            noise_.Init();
-            noise_.SetAmp(1.f);
-            noiseFilterHP_.Init(sampleRate);
-            noiseFilterLP_.Init(sampleRate);
+        // Ring modulates the generator by source, amount crossfades between
+        // the dry and the modulated signal. A negative source removes the
+        // route.
+        void SetRing(int generator, int source, float amount)
+        {
+            conf_[generator].ringSource = source;
+            conf_[generator].ringAmt = amount;
+        }
 
+        void SetPanLaw(PanLaw law)
+        {
+            panLaw_ = law;
             for (int i = 0; i < kGenerators; i++)
             {
-                envelopes_[i].Init(sampleRate);
+                UpdateGains(i);
             }
         }
 
-        void SetPitch(float pitch)
+        // The same seed gives the same sequence of patches. Saving State()
+        // before a Randomize and restoring it gives the same patch again.
+        void Seed(uint32_t seed)
         {
-            basePitch_ = fclamp(pitch, 0, 127);
-            SetFrequencies();
+            random_.Seed(seed, 0);
         }
 
-        void SetCharacter(float character)
+        uint32_t State() const
         {
-            hOsc2_.SetWaveshape(character);
-            hOsc2_.SetPW(1.f - character);
-            hOsc3_.SetPw(character);
-            hOsc4_.SetPw(character);
+            return random_.State();
+        }
 
-            lOsc2_.SetWaveshape(character);
-            lOsc2_.SetPW(1.f - character);
-            lOsc3_.SetPw(character);
-            lOsc4_.SetPw(character);
+        void Restore(uint32_t state)
+        {
+            random_.SetState(state);
         }
 
-        void Randomize()
+        static constexpr size_t kRamps{3 * kGenerators};
+
+        // The ramps of the parameters set by Apply, volume, pan and pitch of
+        // each generator, for the ramps check of the renderer. Returns how
+        // many were stored in ramps.
+        size_t Ramps(const Ramp *ramps[kRamps]) const
+        {
+            size_t count{0};
+            for (int i = 0; i < kGenerators; i++)
+            {
+                ramps[count++] = &volumes_[i];
+                ramps[count++] = &pans_[i];
+                ramps[count++] = &pitches_[i];
+            }
+
+            return count;
+        }
+
+        // Fills patch with random values, the bank itself is not touched.
+        void Randomize(GeneratorPatch &patch)
         {
             int actives{0};
             int half{kGenerators / 2};
             for (int i = 0; i < kGenerators; i++)
             {
-                bool active{1 == std::rand() % 2};
+                GeneratorConf &conf{patch.conf[i]};
+                bool active{random_.Chance(2)};
                 // Limit the number of inactive generators to half of their total number.
                 if (i >= half && !active && actives < half)
                 {
                     active = true;
                 }
-                conf_[i].active = active;
+                conf.active = active;
                 if (active)
                 {
                     ++actives;
                 }
-                conf_[i].pan = RandomFloat(0.3f, 0.7f);
-
-                if (i < kGenerators - 1)
-                {
-                    if (i % 2 == 0)
-                    {
-                        conf_[i].interval = RandomInterval(Range::HIGH);
-                    }
-                    else
-                    {
-                        conf_[i].interval = RandomInterval(Range::LOW);
-                    }
-                }
-                else
+                conf.pan = random_.Float(0.3f, 0.7f);
+
+                float times[3];
+                random_.Fill(times, 3, 0.f, 2.f);
+                patch.envelopes[i].attack = times[0];
+                patch.envelopes[i].decay = times[1];
+                patch.envelopes[i].release = times[2];
+                patch.envelopes[i].sustain = random_.Float();
+
+                // About one generator in three is ring modulated by another one.
+                conf.ringSource = -1;
+                if (random_.Chance(3))
                 {
-                    conf_[i].interval = RandomInterval(Range::FULL);
+                    conf.ringSource = (i + 1 + random_.Int(kGenerators - 1)) % kGenerators;
                 }
-
-                envelopes_[i].SetAttackTime(RandomFloat(0.f, 2.f));
-                envelopes_[i].SetDecayTime(RandomFloat(0.f, 2.f));
-                envelopes_[i].SetSustainLevel(RandomFloat(0.f, 1.f));
-                envelopes_[i].SetReleaseTime(RandomFloat(0.f, 2.f));
-
-                //conf_[i].ringSource = std::floor(RandomFloat(0.f, kGenerators - 1));
+                conf.ringAmt = random_.Float();
             }
             for (int i = 0; i < kGenerators; i++)
             {
-                if (conf_[i].active)
-                {
-                    conf_[i].volume = 1.f / actives; //RandomFloat(0.3f, 0.5f);
-                }
+                patch.conf[i].volume = patch.conf[i].active ? 1.f / actives : 0.f; //random_.Float(0.3f, 0.5f);
             }
 
-            hOsc2_.SetWaveshape(RandomFloat(0.f, 1.f));
-            hOsc2_.SetPW(RandomFloat(-1.f, 1.f));
-
-            hOsc3_.SetPw(RandomFloat(-1.f, 1.f));
-
-            hOsc4_.SetPw(RandomFloat(-1.f, 1.f));
-
-            lOsc2_.SetWaveshape(RandomFloat(0.f, 1.f));
-            lOsc2_.SetPW(RandomFloat(-1.f, 1.f));
-
-            lOsc3_.SetPw(RandomFloat(-1.f, 1.f));
+            ForEachGenerator([this, &patch](auto &generator, int i) {
+                patch.conf[i].interval = random_.Interval(generator.kRange);
+                generator.Randomize(random_, patch.slots[i]);
+            });
+        }
 
-            lOsc4_.SetPw(RandomFloat(-1.f, 1.f));
+        // Sets a patch made by Randomize, volume, pan and pitch glide to the
+        // new values. A generator that the patch switches off keeps playing
+        // until its volume has faded out.
+        void Apply(const GeneratorPatch &patch)
+        {
+            for (int i = 0; i < kGenerators; i++)
+            {
+                const GeneratorConf &conf{patch.conf[i]};
+                stopping_[i] = !conf.active && conf_[i].active;
+                conf_[i].active = conf.active || stopping_[i];
+                conf_[i].interval = conf.interval;
+                SetRing(i, conf.ringSource, conf.ringAmt);
+                // The fade out ends at 0 whatever the volume of the patch.
+                SetVolume(i, conf.active ? conf.volume : 0.f);
+                SetPan(i, conf.pan);
+
+                envelopes_[i].SetAttackTime(patch.envelopes[i].attack);
+                envelopes_[i].SetDecayTime(patch.envelopes[i].decay);
+                envelopes_[i].SetSustainLevel(patch.envelopes[i].sustain);
+                envelopes_[i].SetReleaseTime(patch.envelopes[i].release);
+            }
 
-            conf_[8].character = RandomFloat(1.f, 2.f);
+            ForEachGenerator([&patch](auto &generator, int i) {
+                generator.Apply(patch.slots[i]);
+            });
 
             SetFrequencies();
         }
@@ -171,128 +491,240 @@ namespace orchard
             envelopeGate_ = gate;
         }
 
+        // Modulation set once per block and reached at the end of the next
+        // one, see BlockRamp. The pitch is offset by the given semitones,
+        // after quantization. The character of all the generators follows
+        // the modulation while it moves.
+        void SetPitchModulation(float semitones)
+        {
+            pitchMod_.SetTarget(semitones);
+        }
+
+        void SetCharacterModulation(float character)
+        {
+            characterMod_.SetTarget(character);
+        }
+
         void Process(float &left, float &right)
         {
-            // Process all generators.
-            float sigs[kGenerators];
-            for (int i = 0; i < kGenerators; i++)
+            ProcessBlock(&left, &right, 1);
+        }
+
+        // Mixes n samples of all the active generators into left and right.
+        // Every generator is rendered first, so that the ring modulation
+        // matrix can read the unmodulated signal of any source.
+        void ProcessBlock(float *left, float *right, size_t n)
+        {
+            if (!pitchMod_.IsDone() || !characterMod_.IsDone())
             {
-                if (conf_[i].active)
-                {
-                    if (i == 0)
-                    {
-                        sigs[i] = hOsc1_.Process();
-                    }
-                    else if (i == 1)
-                    {
-                        sigs[i] = lOsc1_.Process();
-                    }
-                    else if (i == 2)
-                    {
-                        sigs[i] = hOsc2_.Process();
-                    }
-                    else if (i == 3)
-                    {
-                        sigs[i] = lOsc2_.Process();
-                    }
-                    else if (i == 4)
-                    {
-                        sigs[i] = hOsc3_.Process();
-                    }
-                    else if (i == 5)
-                    {
-                        sigs[i] = lOsc3_.Process();
-                    }
-                    else if (i == 6)
-                    {
-                        sigs[i] = hOsc4_.Process();
-                    }
-                    else if (i == 7)
-                    {
-                        sigs[i] = lOsc4_.Process();
-                    }
-                    else if (i == 8)
+                ModulatedBlock(n);
+            }
+            else
+            {
+                ForEachGenerator([this, n](auto &generator, int i) {
+                    if (conf_[i].active)
                     {
-                        sigs[i] = noise_.Process();
-                        sigs[i] = conf_[i].character * sigs[i];
-                        sigs[i] = noiseFilterHP_.Process(sigs[i]);
-                        sigs[i] = conf_[i].character * sigs[i];
-                        sigs[i] = SoftClip(noiseFilterLP_.Process(sigs[i]));
+                        if (!pitches_[i].IsDone())
+                        {
+                            generator.SetFreq(Mtof(pitches_[i].Process(n)) * pitchRatio_);
+                        }
+                        generator.ProcessBlock(sigs_[i], n);
                     }
-
-                    left += sigs[i] * conf_[i].volume * (1 - conf_[i].pan) * envelopes_[i].Process(envelopeGate_);
-                    right += sigs[i] * conf_[i].volume * conf_[i].pan * envelopes_[i].Process(envelopeGate_);
-                }
+                });
             }
 
-            /*
-            // Apply ring modulation.
             for (int i = 0; i < kGenerators; i++)
             {
-                if (conf_[i].ringSource > 0 && conf_[i].active && conf_[conf_[i].ringSource].active)
+                if (!conf_[i].active)
+                {
+                    continue;
+                }
+
+                const float leftGain{conf_[i].leftGain};
+                const float rightGain{conf_[i].rightGain};
+                if (!volumes_[i].IsDone() || !pans_[i].IsDone())
                 {
-                    sigs[i] = SoftClip(sigs[i] * sigs[conf_[i].ringSource]);
+                    volumes_[i].Process(n);
+                    pans_[i].Process(n);
+                    UpdateGains(i);
+                }
+
+                if (IsRingRouted(i))
+                {
+                    PROFILE_STAGE(Stage::RING);
+                    RingBlock(i, n);
+                    MixBlock(i, ringSig_, leftGain, rightGain, left, right, n);
+                }
+                else
+                {
+                    MixBlock(i, sigs_[i], leftGain, rightGain, left, right, n);
+                }
+
+                if (stopping_[i] && volumes_[i].IsDone())
+                {
+                    conf_[i].active = false;
+                    stopping_[i] = false;
                 }
-                left += sigs[i] * conf_[i].volume * (1 - conf_[i].pan) * envelopes_[i].Process(envelopeGate);
-                right += sigs[i] * conf_[i].volume * conf_[i].pan * envelopes_[i].Process(envelopeGate);
             }
-            */
         }
 
     private:
-        float CalcFrequency(int generator, float pitch)
+        // Calls function(generator, index) for every slot, unrolled at compile
+        // time so that each slot's Process is inlined.
+        template <size_t I = 0, typename Function>
+        inline typename std::enable_if<(I < kGenerators)>::type ForEachGenerator(Function function)
         {
-            float midi_nn = fclamp(pitch + conf_[generator].interval, 0.f, 120.f);
+            function(std::get<I>(generators_), static_cast<int>(I));
+            ForEachGenerator<I + 1>(function);
+        }
+
+        template <size_t I = 0, typename Function>
+        inline typename std::enable_if<(I == kGenerators)>::type ForEachGenerator(Function function) {}
+
+        // Renders the generators in sub-blocks while the modulation moves,
+        // the frequency and the character are set once per sub-block.
+        void ModulatedBlock(size_t n)
+        {
+            const bool pitchMoving{!pitchMod_.IsDone()};
+            const bool characterMoving{!characterMod_.IsDone()};
+            float ratios[kMaxSubBlocks];
+            float characters[kMaxSubBlocks];
+            const size_t subBlocks{(n + kSubBlockSize - 1) / kSubBlockSize};
+            for (size_t k = 0; k < subBlocks; k++)
+            {
+                const size_t end{std::min((k + 1) * kSubBlockSize, n)};
+                ratios[k] = pitchMoving ? Exp2(pitchMod_.At(end, n) * (1.f / 12.f)) : pitchRatio_;
+                characters[k] = characterMod_.At(end, n);
+            }
+            pitchMod_.Advance();
+            characterMod_.Advance();
+            pitchRatio_ = ratios[subBlocks - 1];
 
-            return mtof(midi_nn);
+            ForEachGenerator([this, n, pitchMoving, characterMoving, &ratios, &characters](auto &generator, int i) {
+                if (!conf_[i].active)
+                {
+                    return;
+                }
+                const bool gliding{!pitches_[i].IsDone()};
+                const float freq{Mtof(gliding ? pitches_[i].Process(n) : pitches_[i].Value())};
+                float *sig{sigs_[i]};
+                for (size_t k = 0, start = 0; start < n; k++, start += kSubBlockSize)
+                {
+                    if (pitchMoving || (gliding && 0 == k))
+                    {
+                        generator.SetFreq(freq * ratios[k]);
+                    }
+                    if (characterMoving)
+                    {
+                        generator.SetCharacter(characters[k]);
+                    }
+                    generator.ProcessBlock(sig + start, std::min(kSubBlockSize, n - start));
+                }
+            });
         }
 
-        void SetFrequencies()
+        // Folds the current volume and pan into the generator's stereo gain
+        // pair, only when one of them changes.
+        void UpdateGains(int generator)
         {
-            hOsc1_.SetFreq(CalcFrequency(0, basePitch_));
-            hOsc2_.SetFreq(CalcFrequency(2, basePitch_));
-            hOsc3_.SetFreq(CalcFrequency(4, basePitch_));
-            hOsc4_.SetFreq(CalcFrequency(6, basePitch_));
+            float left;
+            float right;
+            PanGains(panLaw_, pans_[generator].Value(), left, right);
+            conf_[generator].leftGain = volumes_[generator].Value() * left;
+            conf_[generator].rightGain = volumes_[generator].Value() * right;
+        }
 
-            lOsc1_.SetFreq(CalcFrequency(1, basePitch_));
-            lOsc2_.SetFreq(CalcFrequency(3, basePitch_));
-            lOsc3_.SetFreq(CalcFrequency(5, basePitch_));
-            lOsc4_.SetFreq(CalcFrequency(7, basePitch_));
+        // A route needs an active source other than the generator itself. A
+        // source fading out after a patch change no longer counts, the
+        // routes change with the patch.
+        inline bool IsRingRouted(int generator) const
+        {
+            int source{conf_[generator].ringSource};
 
-            float f{CalcFrequency(8, basePitch_)};
-            noiseFilterHP_.SetFreq(f);
-            noiseFilterLP_.SetFreq(f);
+            return source >= 0 && source != generator && conf_[source].active && !stopping_[source] && conf_[generator].ringAmt > 0.f;
         }
 
-        float basePitch_;
-        bool envelopeGate_{false};
+        // Crossfades the generator with its ring modulated signal into
+        // ringSig_.
+        void RingBlock(int generator, size_t n)
+        {
+            const float *sig{sigs_[generator]};
+            const float *mod{sigs_[conf_[generator].ringSource]};
+            const float amount{conf_[generator].ringAmt};
+            for (size_t s = 0; s < n; s++)
+            {
+                ringSig_[s] = sig[s] + amount * (SoftClip(sig[s] * mod[s]) - sig[s]);
+            }
+        }
 
-        Oscillator hOsc1_;            // Sine
-        VariableSawOscillator hOsc2_; // Bipolar ramp
-        BlOsc hOsc3_;                 // Triangle
-        BlOsc hOsc4_;                 // Square
+        // Mixes n samples of the given generator signal. The envelope runs
+        // once per sample and scales the stereo gain pair, interpolated from
+        // the given gains to the current ones.
+        inline void MixBlock(int i, const float *sig, float leftGain, float rightGain, float *left, float *right, size_t n)
+        {
+            const float leftIncrement{(conf_[i].leftGain - leftGain) / n};
+            const float rightIncrement{(conf_[i].rightGain - rightGain) / n};
+            Adsr &envelope{envelopes_[i]};
+            const bool gate{envelopeGate_};
+            for (size_t s = 0; s < n; s++)
+            {
+                leftGain += leftIncrement;
+                rightGain += rightIncrement;
+                float out{sig[s] * envelope.Process(gate)};
+                left[s] += out * leftGain;
+                right[s] += out * rightGain;
+            }
+        }
 
-        Oscillator lOsc1_;            // Sine
-        VariableSawOscillator lOsc2_; // Bipolar ramp
-        BlOsc lOsc3_;                 // Triangle
-        BlOsc lOsc4_;                 // Square
+        // The interval of the generator is taken in the scale and the result
+        // quantized again, as the base note is not always its root. The cap
+        // comes first so that the pitch is always a note of the scale.
+        int CalcPitch(int generator, int note)
+        {
+            return quantizer_.Note(std::min(note + quantizer_.Interval(conf_[generator].interval), 120));
+        }
 
-        WhiteNoise noise_;
+        // The frequency is Mtof of the pitch ramp, at rest as during a glide.
+        // Inactive generators are left alone, the first pitch of a generator
+        // is reached immediately.
+        void SetFrequencies()
+        {
+            ForEachGenerator([this](auto &generator, int i) {
+                if (!conf_[i].active)
+                {
+                    return;
+                }
+                pitches_[i].SetTarget(CalcPitch(i, baseNote_));
+                if (pitches_[i].IsDone())
+                {
+                    generator.SetFreq(Mtof(pitches_[i].Value()) * pitchRatio_);
+                }
+            });
+        }
 
-        ATone noiseFilterHP_;
-        Tone noiseFilterLP_;
+        float basePitch_{0.f};
+        int baseNote_{0};
+        Quantizer quantizer_;
+        BlockRamp pitchMod_;
+        BlockRamp characterMod_;
+        // Frequency ratio of the pitch modulation at the end of the last
+        // block.
+        float pitchRatio_{1.f};
+        bool envelopeGate_{false};
+        PanLaw panLaw_{PanLaw::CONSTANT_POWER};
+        Prng random_;
 
+        OscillatorBank oscillators_;
+        Generators generators_;
         Adsr envelopes_[kGenerators];
-        // Generators configuration:
-        // 0 = hOsc1_
-        // 1 = lOsc1_
-        // 2 = hOsc2_
-        // 3 = lOsc2_
-        // 4 = hOsc3_
-        // 5 = lOsc3_
-        // 6 = hOsc4_
-        // 7 = lOsc4_
-        // 8 = noise_
+        Ramp volumes_[kGenerators];
+        Ramp pans_[kGenerators];
+        Ramp pitches_[kGenerators];
         GeneratorConf conf_[kGenerators];
+        // Switched off by the last patch, active until the volume reaches 0.
+        bool stopping_[kGenerators]{};
+
+        float sigs_[kGenerators][kMaxBlockSize];
+        float ringSig_[kMaxBlockSize];
     };
-}
\ No newline at end of file
+}
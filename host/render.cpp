@@ -0,0 +1,876 @@
+// Offline renderer for the Orchard chain, it runs the same processing as
+// AudioCallback in bluemchen/Orchard.cpp and writes the result to a WAV file.
+//
+// Usage: orchard_render [options]
+//   -s <seed>      Random seed for the patches, as seeded on the hardware
+//                  (default 1)
+//   -r <rate>      Sample rate (default 48000)
+//   -b <size>      Block size, up to kMaxBlockSize (default 48)
+//   -d <seconds>   Duration (default 10)
+//   -p <pitch>     Base pitch, midi note (default 54, knob2 at noon)
+//   -S <scale>     Scale the pitches are quantized to, 0 is ionian and 6
+//                  locrian as in the Scale menu (default 2, phrygian)
+//   -k <root>      Root of the scale, 0 is C (default 0)
+//   -g <seconds>   Envelope gate period, 0 keeps the gate open (default 0).
+//                  The gate is the clock of the delay as well
+//   -n <seconds>   Randomize both banks again with this period, as pressing
+//                  "All" in the menu, 0 never does (default 0)
+//   -o <file>      Output WAV file (default orchard.wav)
+//   -m <mode>      "block" uses ProcessBlock, "sample" the per-sample Process
+//                  API (default block). Without -n, -g and -M both render the
+//                  same file, as any block size does. Patches, gates and the
+//                  LFO are taken at the start of a block and the glides move
+//                  a block at a time, so they depend on the block size
+//   -R <0|1>       Keep the ring modulation routes set by Randomize (default 1)
+//   -O <factor>    Oversampling of the saturator, 1, 2 or 4 (default 2)
+//   -v <reverb>    "sc" for ReverbSc, "diffuser" for the diffuser reverb, whose
+//                  LFOs move once per block (default sc)
+//   -M <target>    Routes a sine LFO, as CV 2, to "pitch", "character",
+//                  "cutoff", "damp" or "size" (default none), sampled once
+//                  per block
+//   -L <hz>        Frequency of the LFO (default 5)
+//   -c <check>     "denormals" feeds an impulse to the effects, all active and
+//                  never sleeping, followed by silence, and fails if the cost
+//                  of a block grows while the tails decay (run it for minutes).
+//                  "tables" compares the lookup tables of tables.h with libm
+//                  and fails if they are off by more than kMaxTableError.
+//                  "oscillators" compares the voices of OscillatorBank with
+//                  the DaisySP oscillators they replace, fails if they are
+//                  off by more than kMaxOscillatorError RMS, and prints how
+//                  many voices of each fit in a core. Nothing is rendered by
+//                  these two.
+//                  "ramps" randomizes the banks again every -n seconds (1 if
+//                  not given) and fails if a parameter changed by a patch has
+//                  stopped gliding one block after it was applied
+//
+// When built with PROFILE=1 the per-stage cycle counts are printed as well.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "Synthesis/blosc.h"
+#include "Synthesis/oscillator.h"
+#include "Synthesis/variablesawosc.h"
+
+#include "arena.h"
+#include "commons.h"
+#include "denormals.h"
+#include "generatorbank.h"
+#include "effectbank.h"
+#include "limiter.h"
+#include "modulation.h"
+#include "oscillatorbank.h"
+#include "patch.h"
+#include "profiler.h"
+#include "quantizer.h"
+#include "tables.h"
+
+using namespace daisysp;
+using namespace orchard;
+
+enum class Check
+{
+    NONE,
+    DENORMALS,
+    TABLES,
+    OSCILLATORS,
+    RAMPS,
+};
+
+struct Options
+{
+    unsigned int seed{1};
+    float sampleRate{48000.f};
+    size_t blockSize{48};
+    float seconds{10.f};
+    float pitch{54.f};
+    Scale scale{kDefaultScale};
+    int root{0};
+    float gatePeriod{0.f};
+    float randomizePeriod{0.f};
+    const char *output{"orchard.wav"};
+    bool perSample{false};
+    bool ring{true};
+    ReverbType reverbType{ReverbType::SC};
+    int oversampling{2};
+    ModSource modSource{ModSource::NONE};
+    ModTarget modTarget{ModTarget::PITCH};
+    float lfoFreq{5.f};
+    Check check{Check::NONE};
+};
+
+Limiter limiter;
+
+alignas(32) uint8_t sdramMemory[kSdramSize];
+Arena sdram;
+
+GeneratorBank generatorBank;
+EffectBank effectBank;
+Mailbox<Patch> patches;
+ModMatrix modMatrix;
+
+constexpr const char *kModTargetNames[kModTargets]{"pitch", "character", "cutoff", "damp", "size"};
+
+void Usage(const char *name)
+{
+    std::fprintf(stderr, "Usage: %s [-s seed] [-r rate] [-b size] [-d seconds] [-p pitch] [-S scale] [-k root] [-g seconds] [-n seconds] [-o file] [-m block|sample] [-R 0|1] [-O 1|2|4] [-v sc|diffuser] [-M target] [-L hz] [-c denormals|tables|oscillators|ramps]\n", name);
+}
+
+bool ParseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc || argv[i][0] != '-' || std::strlen(argv[i]) != 2)
+        {
+            return false;
+        }
+        const char *value{argv[++i]};
+        switch (argv[i - 1][1])
+        {
+        case 's':
+            options.seed = std::strtoul(value, nullptr, 10);
+            break;
+        case 'r':
+            options.sampleRate = std::strtof(value, nullptr);
+            break;
+        case 'b':
+            options.blockSize = std::strtoul(value, nullptr, 10);
+            break;
+        case 'd':
+            options.seconds = std::strtof(value, nullptr);
+            break;
+        case 'p':
+            options.pitch = std::strtof(value, nullptr);
+            break;
+        case 'S':
+            options.scale = static_cast<Scale>(std::atoi(value));
+            if (options.scale < Scale::IONIAN || options.scale >= Scale::LAST_SCALE)
+            {
+                return false;
+            }
+            break;
+        case 'k':
+            options.root = std::atoi(value);
+            if (options.root < 0 || options.root > 11)
+            {
+                return false;
+            }
+            break;
+        case 'g':
+            options.gatePeriod = std::strtof(value, nullptr);
+            break;
+        case 'n':
+            options.randomizePeriod = std::strtof(value, nullptr);
+            break;
+        case 'o':
+            options.output = value;
+            break;
+        case 'R':
+            options.ring = 0 != std::atoi(value);
+            break;
+        case 'O':
+            options.oversampling = std::atoi(value);
+            if (1 != options.oversampling && 2 != options.oversampling && 4 != options.oversampling)
+            {
+                return false;
+            }
+            break;
+        case 'v':
+            if (0 == std::strcmp(value, "diffuser"))
+            {
+                options.reverbType = ReverbType::DIFFUSER;
+            }
+            else if (0 != std::strcmp(value, "sc"))
+            {
+                return false;
+            }
+            break;
+        case 'M':
+            options.modSource = ModSource::NONE;
+            for (int t = 0; t < kModTargets; t++)
+            {
+                if (0 == std::strcmp(value, kModTargetNames[t]))
+                {
+                    options.modSource = ModSource::CV;
+                    options.modTarget = static_cast<ModTarget>(t);
+                }
+            }
+            if (ModSource::NONE == options.modSource)
+            {
+                return false;
+            }
+            break;
+        case 'L':
+            options.lfoFreq = std::strtof(value, nullptr);
+            break;
+        case 'c':
+            if (0 == std::strcmp(value, "denormals"))
+            {
+                options.check = Check::DENORMALS;
+            }
+            else if (0 == std::strcmp(value, "tables"))
+            {
+                options.check = Check::TABLES;
+            }
+            else if (0 == std::strcmp(value, "oscillators"))
+            {
+                options.check = Check::OSCILLATORS;
+            }
+            else if (0 == std::strcmp(value, "ramps"))
+            {
+                options.check = Check::RAMPS;
+            }
+            else
+            {
+                return false;
+            }
+            break;
+        case 'm':
+            if (0 == std::strcmp(value, "sample"))
+            {
+                options.perSample = true;
+            }
+            else if (0 != std::strcmp(value, "block"))
+            {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return options.sampleRate > 0.f && options.blockSize > 0 && options.blockSize <= kMaxBlockSize && options.seconds > 0.f;
+}
+
+void WriteLe(std::FILE *file, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        std::fputc((value >> (8 * i)) & 0xff, file);
+    }
+}
+
+// Writes interleaved stereo samples as a 32 bit float WAV, so that renders can
+// be compared bit by bit.
+bool WriteWav(const char *path, const std::vector<float> &samples, uint32_t sampleRate)
+{
+    std::FILE *file{std::fopen(path, "wb")};
+    if (!file)
+    {
+        return false;
+    }
+
+    const uint32_t channels{2};
+    const uint32_t dataSize{static_cast<uint32_t>(samples.size() * sizeof(float))};
+
+    std::fputs("RIFF", file);
+    WriteLe(file, 36 + dataSize, 4);
+    std::fputs("WAVEfmt ", file);
+    WriteLe(file, 16, 4);
+    WriteLe(file, 3, 2); // IEEE float
+    WriteLe(file, channels, 2);
+    WriteLe(file, sampleRate, 4);
+    WriteLe(file, sampleRate * channels * sizeof(float), 4);
+    WriteLe(file, channels * sizeof(float), 2);
+    WriteLe(file, 8 * sizeof(float), 2);
+    std::fputs("data", file);
+    WriteLe(file, dataSize, 4);
+    for (float sample : samples)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &sample, sizeof(bits));
+        WriteLe(file, bits, 4);
+    }
+
+    return 0 == std::fclose(file);
+}
+
+// What Randomize does in the main loop, the patch is applied at the start of
+// the next block.
+void Randomize(const Options &options)
+{
+    Patch *patch{patches.Acquire()};
+    if (!patch)
+    {
+        return;
+    }
+    patch->hasGenerators = true;
+    patch->hasEffects = true;
+    generatorBank.Randomize(patch->generators);
+    effectBank.Randomize(patch->effects);
+    if (Check::DENORMALS == options.check)
+    {
+        // Long delay tails.
+        patch->effects.conf[2].param1 = 0.9f;
+    }
+    if (!options.ring)
+    {
+        for (int i = 0; i < kGenerators; i++)
+        {
+            patch->generators.conf[i].ringSource = -1;
+            patch->generators.conf[i].ringAmt = 0.f;
+        }
+    }
+    patches.Publish();
+}
+
+// Cycles per block over the last kProfilerHistory blocks, the share of the
+// real-time budget they take and how often the stage was asleep.
+void PrintProfile()
+{
+    std::printf("%-8s %10s %10s %10s %10s %6s %6s %6s\n", "stage", "min", "mean", "max", "p99", "mean%", "p99%", "sleep%");
+    for (int i = 0; i < kStages; i++)
+    {
+        StageStats stats{profiler.Stats(static_cast<Stage>(i))};
+        std::printf("%-8s %10u %10u %10u %10u %6d %6d %6d\n", kStageNames[i], stats.min, stats.mean, stats.max, stats.p99,
+                    profiler.Load(stats.mean), profiler.Load(stats.p99), stats.asleep);
+    }
+    std::printf("budget %u cycles per block\n", profiler.Budget());
+}
+
+// Cycles per block of the effects after the impulse of the denormals check.
+// In the first kCheckReference seconds the tails are still far from the
+// denormal range, the median block of each later second must not cost much
+// more than theirs: an FPU that doesn't flush denormals to zero makes the
+// blocks about 20 times slower once the tails get there. Medians leave out
+// the blocks slowed down by the host.
+constexpr float kCheckReference{0.05f};
+constexpr float kMaxCostGrowth{1.5f};
+
+bool CheckFlatCost(const std::vector<uint32_t> &cycles, size_t blocksPerSecond, size_t referenceBlocks)
+{
+    auto median = [&cycles](size_t begin, size_t end) {
+        std::vector<uint32_t> sorted(cycles.begin() + begin, cycles.begin() + end);
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+
+        return sorted[sorted.size() / 2];
+    };
+
+    const uint32_t reference{median(0, std::min(referenceBlocks, cycles.size()))};
+    uint32_t worst{0};
+    size_t worstSecond{0};
+    for (size_t i = 0; i < cycles.size(); i += blocksPerSecond)
+    {
+        const uint32_t second{median(i, std::min(i + blocksPerSecond, cycles.size()))};
+        if (second > worst)
+        {
+            worst = second;
+            worstSecond = i / blocksPerSecond;
+        }
+    }
+    const bool flat{worst <= kMaxCostGrowth * reference};
+    std::printf("denormals: %u cycles per block after the impulse, %u in second %zu, %s\n",
+                reference, worst, worstSecond, flat ? "ok" : "FAILED");
+
+    return flat;
+}
+
+// The ramps of both banks, those whose target was changed by a patch, away
+// from their value, are checked at the end of the block it was applied in: a
+// ramp that jumped is done by then, the shortest glides take 5 ms. The first
+// patch is reached immediately, and so is the first pitch of a generator, the
+// generators switched on by the patch are left out.
+class RampCheck
+{
+public:
+    void Init()
+    {
+        count_ = generatorBank.Ramps(ramps_);
+        count_ += effectBank.Ramps(ramps_ + count_);
+    }
+
+    void BeforePatch(const Patch &patch)
+    {
+        for (size_t i = 0; i < count_; i++)
+        {
+            const size_t generator{i / 3};
+            checked_[i] = applied_ && (i >= GeneratorBank::kRamps || active_[generator]);
+            targets_[i] = ramps_[i]->Target();
+            values_[i] = ramps_[i]->Value();
+        }
+        for (int i = 0; patch.hasGenerators && i < kGenerators; i++)
+        {
+            active_[i] = patch.generators.conf[i].active;
+        }
+        applied_ = true;
+        pending_ = true;
+    }
+
+    void AfterBlock()
+    {
+        if (!pending_)
+        {
+            return;
+        }
+        pending_ = false;
+        for (size_t i = 0; i < count_; i++)
+        {
+            const float target{ramps_[i]->Target()};
+            if (checked_[i] && target != targets_[i] && target != values_[i])
+            {
+                changed_++;
+                stopped_ += ramps_[i]->IsDone();
+            }
+        }
+    }
+
+    bool Report() const
+    {
+        const bool ok{changed_ > 0 && 0 == stopped_};
+        std::printf("ramps: %zu of %zu changed parameters gliding one block after the patch, %s\n",
+                    changed_ - stopped_, changed_, ok ? "ok" : "FAILED");
+
+        return ok;
+    }
+
+private:
+    static constexpr size_t kMaxRamps{GeneratorBank::kRamps + EffectBank::kRamps};
+
+    const Ramp *ramps_[kMaxRamps];
+    float targets_[kMaxRamps];
+    float values_[kMaxRamps];
+    bool checked_[kMaxRamps];
+    bool active_[kGenerators]{};
+    bool applied_{false};
+    size_t count_{0};
+    size_t changed_{0};
+    size_t stopped_{0};
+    bool pending_{false};
+};
+
+// Largest relative error of the tables against libm, in double precision.
+constexpr double kMaxTableError{1e-5};
+
+double RelativeError(float value, double reference)
+{
+    return std::fabs(value - reference) / reference;
+}
+
+// Nearest note of the scale on root to note, the lower one on ties, as a
+// plain search over all the notes.
+int NearestScaleNote(Scale scale, int root, int note)
+{
+    const int *row{scales[static_cast<int>(scale)]};
+    int nearest{-1};
+    for (int candidate = 0; candidate < kMidiNotes; candidate++)
+    {
+        bool inScale{false};
+        for (int i = 0; i < scaleIntervals; i++)
+        {
+            inScale = inScale || (candidate - root + 12) % 12 == (row[i] + 12) % 12;
+        }
+        if (inScale && (nearest < 0 || std::abs(candidate - note) < std::abs(nearest - note)))
+        {
+            nearest = candidate;
+        }
+    }
+
+    return nearest;
+}
+
+bool CheckTables()
+{
+    double mtofError{0.};
+    for (float midi = -20.f; midi <= 140.f; midi += 1.f / 64.f)
+    {
+        mtofError = std::max(mtofError, RelativeError(Mtof(midi), 440. * std::pow(2., (midi - 69.) / 12.)));
+    }
+
+    double pow10Error{0.};
+    for (float x = -3.f; x <= 3.f; x += 1.f / 1024.f)
+    {
+        pow10Error = std::max(pow10Error, RelativeError(Pow10(x), std::pow(10., static_cast<double>(x))));
+    }
+
+    double panError{0.};
+    for (int i = 0; i <= kPanTableSize; i++)
+    {
+        panError = std::max(panError, std::fabs(kPanTable.values[i] - std::sin(kHalfPi * i / kPanTableSize)));
+    }
+
+    double scaleError{0.};
+    int wrongNotes{0};
+    for (int s = 0; s < kScales; s++)
+    {
+        const Scale scale{static_cast<Scale>(s)};
+        for (int note = 0; note < kMidiNotes; note++)
+        {
+            const int expected{NearestScaleNote(scale, 0, note)};
+            for (float offset : {-0.49f, 0.f, 0.49f})
+            {
+                const int quantized{QuantizedNote(scale, note + offset)};
+                wrongNotes += expected != quantized ? 1 : 0;
+                scaleError = std::max(scaleError, RelativeError(Mtof(quantized), 440. * std::pow(2., (expected - 69.) / 12.)));
+            }
+        }
+    }
+
+    // The quantizer on every root, over the whole midi range.
+    Quantizer quantizer;
+    quantizer.Init();
+    for (int s = 0; s < kScales; s++)
+    {
+        const Scale scale{static_cast<Scale>(s)};
+        quantizer.SetScale(scale);
+        for (int root = 0; root < 12; root++)
+        {
+            quantizer.SetRoot(root);
+            for (int note = 0; note < kMidiNotes; note++)
+            {
+                const int expected{NearestScaleNote(scale, root, note)};
+                for (float offset : {-0.49f, 0.f, 0.49f})
+                {
+                    const int quantized{quantizer.Note(note + offset)};
+                    wrongNotes += expected != quantized || quantized < 0 || quantized >= kMidiNotes ? 1 : 0;
+                    scaleError = std::max(scaleError, RelativeError(Mtof(quantized), 440. * std::pow(2., (expected - 69.) / 12.)));
+                }
+            }
+        }
+    }
+
+    const bool ok{mtofError <= kMaxTableError && pow10Error <= kMaxTableError && panError <= kMaxTableError && scaleError <= kMaxTableError && 0 == wrongNotes};
+    std::printf("tables: relative error mtof %.2g, pow10 %.2g, scales %.2g, absolute error pan %.2g, %d wrong notes, %s\n",
+                mtofError, pow10Error, scaleError, panError, wrongNotes, ok ? "ok" : "FAILED");
+
+    return ok;
+}
+
+// RMS difference between a voice and its DaisySP oscillator over
+// kOscillatorCheckTime. The phases drift apart slowly, the fixed point phase
+// of the bank being more accurate, so a step of the saw or the pulse can land
+// one sample apart: the largest difference isn't a useful measure.
+constexpr float kMaxOscillatorError{0.01f};
+// The triangle is compared with a naive one, the band limited corners differ
+// from it by up to a tenth at midi 96 on the steepest slopes.
+constexpr float kMaxTriangleError{0.02f};
+constexpr float kOscillatorCheckTime{0.1f};
+// Audio rendered by each oscillator for the benchmark, in seconds, in runs
+// of which the fastest one counts, as other processes slow some of them down.
+constexpr float kOscillatorBenchTime{4.f};
+constexpr int kOscillatorBenchRuns{5};
+
+// The reference oscillator of a voice, processed one sample at a time. The
+// triangle is compared with the variable saw at shape 0, the triangle of
+// BlOsc being its leaky integrated square.
+struct ReferenceOscillator
+{
+    void Init(Waveform waveform, float sampleRate, float freq, float pw, float shape)
+    {
+        waveform_ = waveform;
+        sine_.Init(sampleRate);
+        sine_.SetWaveform(Oscillator::WAVE_SIN);
+        sine_.SetAmp(1.f);
+        sine_.SetFreq(freq);
+        saw_.Init(sampleRate);
+        saw_.SetFreq(freq);
+        saw_.SetPW(Waveform::TRIANGLE == waveform ? 2.f * fclamp(1.f - pw, 0.05f, 0.95f) - 1.f : pw);
+        saw_.SetWaveshape(Waveform::TRIANGLE == waveform ? 0.f : shape);
+        bl_.Init(sampleRate);
+        bl_.SetWaveform(BlOsc::WAVE_SQUARE);
+        bl_.SetAmp(1.f);
+        bl_.SetFreq(freq);
+        bl_.SetPw(pw);
+    }
+
+    void ProcessBlock(float *out, size_t n)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            switch (waveform_)
+            {
+            case Waveform::SINE:
+                out[i] = sine_.Process();
+                break;
+
+            case Waveform::PULSE:
+                out[i] = bl_.Process();
+                break;
+
+            default:
+                out[i] = saw_.Process();
+                break;
+            }
+        }
+    }
+
+    Waveform waveform_;
+    Oscillator sine_;
+    VariableSawOscillator saw_;
+    BlOsc bl_;
+};
+
+// Renders kOscillatorBenchTime of every voice with the bank and with the
+// reference oscillators, and returns the seconds both took in their fastest
+// run.
+void BenchOscillators(const Waveform (&waveforms)[kMaxVoices], float sampleRate, size_t blockSize, double &bankTime, double &referenceTime)
+{
+    const size_t benchFrames{static_cast<size_t>(kOscillatorBenchTime * sampleRate)};
+    OscillatorBank bank;
+    bank.Init(sampleRate);
+    ReferenceOscillator references[kMaxVoices];
+    for (int v = 0; v < kMaxVoices; v++)
+    {
+        const float freq{Mtof(36.f + 7.f * v)};
+        bank.SetFreq(bank.AddVoice(waveforms[v]), freq);
+        references[v].Init(waveforms[v], sampleRate, freq, 0.f, 0.5f);
+    }
+    volatile float sink{0.f};
+    float out[kMaxBlockSize];
+    bankTime = 0.;
+    referenceTime = 0.;
+    for (int run = 0; run < kOscillatorBenchRuns; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t frame = 0; frame < benchFrames; frame += blockSize)
+        {
+            for (int v = 0; v < kMaxVoices; v++)
+            {
+                bank.ProcessBlock(v, out, blockSize);
+                sink = sink + out[0];
+            }
+        }
+        const double bankRun{std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()};
+        start = std::chrono::steady_clock::now();
+        for (size_t frame = 0; frame < benchFrames; frame += blockSize)
+        {
+            for (int v = 0; v < kMaxVoices; v++)
+            {
+                references[v].ProcessBlock(out, blockSize);
+                sink = sink + out[0];
+            }
+        }
+        const double referenceRun{std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()};
+        bankTime = 0 == run ? bankRun : std::min(bankTime, bankRun);
+        referenceTime = 0 == run ? referenceRun : std::min(referenceTime, referenceRun);
+    }
+}
+
+bool CheckOscillators(float sampleRate, size_t blockSize)
+{
+    constexpr int kWaveforms{4};
+    const char *names[kWaveforms]{"sine", "saw", "pulse", "triangle"};
+    const size_t checkFrames{static_cast<size_t>(kOscillatorCheckTime * sampleRate)};
+    bool ok{true};
+    for (int w = 0; w < kWaveforms; w++)
+    {
+        const Waveform waveform{static_cast<Waveform>(w)};
+        float error{0.f};
+        for (float midi : {24.f, 48.f, 72.f, 96.f})
+        {
+            for (float pw : {-0.6f, 0.f, 0.4f})
+            {
+                const float freq{Mtof(midi)};
+                OscillatorBank bank;
+                bank.Init(sampleRate);
+                const int voice{bank.AddVoice(waveform)};
+                bank.SetFreq(voice, freq);
+                bank.SetPw(voice, pw);
+                bank.SetShape(voice, 0.5f);
+                ReferenceOscillator reference;
+                reference.Init(waveform, sampleRate, freq, pw, 0.5f);
+                double sum{0.};
+                for (size_t frame = 0; frame < checkFrames; frame += blockSize)
+                {
+                    const size_t size{std::min(blockSize, checkFrames - frame)};
+                    float out[kMaxBlockSize];
+                    float expected[kMaxBlockSize];
+                    bank.ProcessBlock(voice, out, size);
+                    reference.ProcessBlock(expected, size);
+                    for (size_t i = 0; i < size; i++)
+                    {
+                        sum += (out[i] - expected[i]) * (out[i] - expected[i]);
+                    }
+                }
+                error = std::max(error, static_cast<float>(std::sqrt(sum / checkFrames)));
+            }
+        }
+
+        // Both render kMaxVoices voices of the waveform at different pitches.
+        Waveform waveforms[kMaxVoices];
+        std::fill(waveforms, waveforms + kMaxVoices, waveform);
+        double bankTime;
+        double referenceTime;
+        BenchOscillators(waveforms, sampleRate, blockSize, bankTime, referenceTime);
+
+        const double rendered{kMaxVoices * kOscillatorBenchTime};
+        const bool waveformOk{error <= (Waveform::TRIANGLE == waveform ? kMaxTriangleError : kMaxOscillatorError)};
+        ok = ok && waveformOk;
+        std::printf("oscillators: %-8s error %.2g, voices per core %.0f, DaisySP %.0f (%.1fx), %s\n",
+                    names[w], error, rendered / bankTime, rendered / referenceTime, referenceTime / bankTime,
+                    waveformOk ? "ok" : "FAILED");
+    }
+
+    // The voices of GeneratorBank.
+    const Waveform voices[kMaxVoices]{Waveform::SINE, Waveform::SINE, Waveform::SAW, Waveform::SAW,
+                                      Waveform::TRIANGLE, Waveform::TRIANGLE, Waveform::PULSE, Waveform::PULSE};
+    double bankTime;
+    double referenceTime;
+    BenchOscillators(voices, sampleRate, blockSize, bankTime, referenceTime);
+    const double rendered{kMaxVoices * kOscillatorBenchTime};
+    std::printf("oscillators: bank of the generators, voices per core %.0f, DaisySP %.0f (%.1fx)\n",
+                rendered / bankTime, rendered / referenceTime, referenceTime / bankTime);
+
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+    if (Check::TABLES == options.check)
+    {
+        return CheckTables() ? 0 : 1;
+    }
+    if (Check::OSCILLATORS == options.check)
+    {
+        return CheckOscillators(options.sampleRate, options.blockSize) ? 0 : 1;
+    }
+
+    generatorBank.Init(options.sampleRate);
+    modMatrix.SetRoute(options.modTarget, options.modSource);
+    sdram.Init(sdramMemory, sizeof(sdramMemory));
+    if (!effectBank.Init(options.sampleRate, sdram, options.reverbType))
+    {
+        std::fprintf(stderr, "The effect buffers need more than %zu bytes\n", sdram.Size());
+        return 1;
+    }
+    effectBank.SetOversampling(options.oversampling);
+    effectBank.SetSleep(Check::DENORMALS != options.check);
+    limiter.Init(options.sampleRate, 0.89f, kOutputGain);
+    profiler.Init(options.sampleRate, options.blockSize, CycleCounter::Frequency());
+    if (Check::RAMPS == options.check && options.randomizePeriod <= 0.f)
+    {
+        options.randomizePeriod = 1.f;
+    }
+    RampCheck rampCheck;
+    rampCheck.Init();
+
+    generatorBank.Seed(options.seed);
+    effectBank.Seed(options.seed);
+    Randomize(options);
+
+    const size_t frames{static_cast<size_t>(options.seconds * options.sampleRate)};
+    const size_t gateFrames{static_cast<size_t>(options.gatePeriod * options.sampleRate / 2)};
+    const size_t randomizeFrames{static_cast<size_t>(options.randomizePeriod * options.sampleRate)};
+    size_t nextRandomize{randomizeFrames};
+    std::vector<float> out(frames * 2);
+    std::vector<uint32_t> effectCycles;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t frame = 0; frame < frames; frame += options.blockSize)
+    {
+        // What UpdateControls does in the main loop.
+        const bool gate{0 == gateFrames || 0 == (frame / gateFrames) % 2};
+
+        // What AudioCallback does.
+        FlushDenormals();
+        size_t size{std::min(options.blockSize, frames - frame)};
+        generatorBank.SetScale(options.scale);
+        generatorBank.SetRoot(options.root);
+        generatorBank.SetPitch(options.pitch);
+        const Patch *patch{patches.Peek()};
+        if (patch)
+        {
+            if (Check::RAMPS == options.check)
+            {
+                rampCheck.BeforePatch(*patch);
+            }
+            ApplyPatch(*patch, generatorBank, effectBank);
+            patches.Release();
+        }
+        generatorBank.SetEnvelopeGate(gate);
+        effectBank.SetClock(gate && 0 != gateFrames);
+        modMatrix.SetSource(ModSource::CV, sinf(TWOPI_F * options.lfoFreq * frame / options.sampleRate));
+        ApplyModulation(modMatrix, generatorBank, effectBank);
+        {
+            PROFILE_STAGE(Stage::BLOCK);
+            float left[kMaxBlockSize]{};
+            float right[kMaxBlockSize]{};
+
+            if (Check::DENORMALS == options.check)
+            {
+                if (0 == frame)
+                {
+                    left[0] = 1.f;
+                    right[0] = 1.f;
+                }
+                const uint32_t begin{CycleCounter::Now()};
+                effectBank.ProcessBlock(left, right, size);
+                effectCycles.push_back(CycleCounter::Now() - begin);
+            }
+            else if (options.perSample)
+            {
+                for (size_t i = 0; i < size; i++)
+                {
+                    generatorBank.Process(left[i], right[i]);
+                    effectBank.Process(left[i], right[i]);
+                }
+            }
+            else
+            {
+                {
+                    PROFILE_STAGE(Stage::GENERATORS);
+                    generatorBank.ProcessBlock(left, right, size);
+                }
+                effectBank.ProcessBlock(left, right, size);
+            }
+
+            PROFILE_STAGE(Stage::OUTPUT);
+            limiter.ProcessBlock(left, right, size);
+            for (size_t i = 0; i < size; i++)
+            {
+                out[2 * (frame + i)] = left[i];
+                out[2 * (frame + i) + 1] = right[i];
+            }
+        }
+        PROFILE_END_BLOCK();
+        rampCheck.AfterBlock();
+
+        if (randomizeFrames > 0 && frame + size >= nextRandomize)
+        {
+            Randomize(options);
+            nextRandomize += randomizeFrames;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (!WriteWav(options.output, out, static_cast<uint32_t>(options.sampleRate)))
+    {
+        std::fprintf(stderr, "Cannot write %s\n", options.output);
+        return 1;
+    }
+
+    double rendered{frames / options.sampleRate};
+    std::printf("seed %u, %.0f Hz, block %zu: rendered %.2f s in %.3f s, %.1fx real-time\n",
+                options.seed, options.sampleRate, options.blockSize, rendered, elapsed.count(), rendered / elapsed.count());
+    std::printf("saturator oversampling %dx\n", options.oversampling);
+    std::printf("SDRAM: effects %zu KB, %zu of %zu KB used\n", effectBank.Memory() / 1024, sdram.Used() / 1024, sdram.Size() / 1024);
+
+#ifdef ORCHARD_PROFILE
+    PrintProfile();
+#endif
+
+    const size_t blocksPerSecond{std::max(static_cast<size_t>(options.sampleRate / options.blockSize), size_t{1})};
+    const size_t referenceBlocks{std::max(static_cast<size_t>(kCheckReference * options.sampleRate / options.blockSize), size_t{1})};
+    if (Check::DENORMALS == options.check && !CheckFlatCost(effectCycles, blocksPerSecond, referenceBlocks))
+    {
+        return 1;
+    }
+    if (Check::RAMPS == options.check && !rampCheck.Report())
+    {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace orchard
+{
+    // Delay of the limiter output, in samples, and length of its buffer.
+    constexpr size_t kLimiterLookahead{64};
+    constexpr size_t kLimiterLineSize{128};
+    static_assert(kLimiterLookahead < kLimiterLineSize, "The limiter line is too short");
+    // Peaks of the blocks in the look-ahead window, there are at most
+    // kLimiterLookahead + 1 of them with one sample blocks.
+    constexpr size_t kLimiterHistory{128};
+    static_assert(kLimiterLookahead < kLimiterHistory, "The limiter history is too short");
+
+    // Stereo linked look-ahead limiter. The peak is detected once per block,
+    // the output is delayed by kLimiterLookahead samples and the gain moves
+    // linearly along each block, so that it has reached the level required
+    // by a peak before the peak comes out. Release is a one-pole.
+    class Limiter
+    {
+    public:
+        Limiter() {}
+        ~Limiter() {}
+
+        void Init(float sampleRate, float threshold = 0.89f, float inputGain = 1.f, float release = 0.2f)
+        {
+            sampleRate_ = sampleRate;
+            threshold_ = threshold;
+            inputGain_ = inputGain;
+            releaseCoeff_ = 1.f / (release * sampleRate_);
+            blockSize_ = 0;
+            gain_ = 1.f;
+            now_ = 0;
+            head_ = 0;
+            tail_ = 0;
+            writePtr_ = 0;
+            std::fill(&line_[0][0], &line_[0][0] + 2 * kLimiterLineSize, 0.f);
+        }
+
+        // Linear gain applied before limiting.
+        void SetInputGain(float gain)
+        {
+            inputGain_ = gain;
+        }
+
+        // Current gain reduction, 1 when not limiting.
+        float Gain() const
+        {
+            return gain_;
+        }
+
+        void Process(float &left, float &right)
+        {
+            ProcessBlock(&left, &right, 1);
+        }
+
+        // Processes n samples in place.
+        void ProcessBlock(float *left, float *right, size_t n)
+        {
+            // Each gain ramp must end before the first sample of its block
+            // comes out, longer blocks are split.
+            for (size_t i = 0; i < n; i += kLimiterLookahead)
+            {
+                ProcessChunk(left + i, right + i, std::min(n - i, kLimiterLookahead));
+            }
+        }
+
+    private:
+        static constexpr size_t kMask{kLimiterLineSize - 1};
+        static constexpr size_t kHistoryMask{kLimiterHistory - 1};
+
+        void ProcessChunk(float *left, float *right, size_t n)
+        {
+            float peak{0.f};
+            for (size_t i = 0; i < n; i++)
+            {
+                const float l{std::fabs(left[i])};
+                const float r{std::fabs(right[i])};
+                peak = std::max(peak, std::max(l, r));
+            }
+            now_ += n;
+            PushPeak(peak * inputGain_);
+
+            // The samples that come out of this block and the ones still in
+            // the buffer were all part of the last kLimiterLookahead + n
+            // samples.
+            const float held{HeldPeak(now_ - static_cast<uint32_t>(n + kLimiterLookahead))};
+            const float target{held > threshold_ ? threshold_ / held : 1.f};
+            float end{target};
+            if (target > gain_)
+            {
+                if (n != blockSize_)
+                {
+                    blockSize_ = n;
+                    blockRelease_ = 1.f - std::pow(1.f - releaseCoeff_, static_cast<float>(n));
+                }
+                end = gain_ + (target - gain_) * blockRelease_;
+            }
+
+            for (size_t i = 0; i < n; i++)
+            {
+                const size_t read{(writePtr_ - kLimiterLookahead) & kMask};
+                line_[0][writePtr_] = left[i];
+                line_[1][writePtr_] = right[i];
+                left[i] = line_[0][read];
+                right[i] = line_[1][read];
+                writePtr_ = (writePtr_ + 1) & kMask;
+            }
+
+            const float start{gain_ * inputGain_};
+            const float increment{(end - gain_) * inputGain_ / n};
+            for (size_t i = 0; i < n; i++)
+            {
+                const float gain{start + increment * (i + 1)};
+                left[i] *= gain;
+                right[i] *= gain;
+            }
+            gain_ = end;
+        }
+
+        // Block peaks are kept in decreasing order (a monotonic queue), so
+        // that the largest one in the window is always at the head.
+        void PushPeak(float peak)
+        {
+            while (tail_ != head_ && peaks_[(tail_ - 1) & kHistoryMask] <= peak)
+            {
+                --tail_;
+            }
+            peaks_[tail_ & kHistoryMask] = peak;
+            ends_[tail_ & kHistoryMask] = now_;
+            ++tail_;
+        }
+
+        // Largest peak of the blocks ending after start.
+        float HeldPeak(uint32_t start)
+        {
+            while (tail_ != head_ && static_cast<int32_t>(ends_[head_ & kHistoryMask] - start) <= 0)
+            {
+                ++head_;
+            }
+
+            return tail_ != head_ ? peaks_[head_ & kHistoryMask] : 0.f;
+        }
+
+        float line_[2][kLimiterLineSize];
+        size_t writePtr_{0};
+
+        float peaks_[kLimiterHistory];
+        uint32_t ends_[kLimiterHistory];
+        size_t head_{0};
+        size_t tail_{0};
+        uint32_t now_{0};
+
+        float sampleRate_{48000.f};
+        float threshold_{0.89f};
+        float inputGain_{1.f};
+        float releaseCoeff_{0.f};
+        float blockRelease_{0.f};
+        size_t blockSize_{0};
+        float gain_{1.f};
+    };
+}
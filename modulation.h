@@ -0,0 +1,90 @@
+#pragma once
+
+#include "generatorbank.h"
+#include "effectbank.h"
+
+namespace orchard
+{
+    // Inputs that can modulate, knob 1 and CV 2 on the hardware.
+    enum class ModSource
+    {
+        NONE,
+        KNOB,
+        CV,
+        LAST_SOURCE,
+    };
+
+    enum class ModTarget
+    {
+        PITCH,
+        CHARACTER,
+        CUTOFF,
+        DAMP,
+        SIZE,
+        LAST_TARGET,
+    };
+
+    constexpr int kModSources{static_cast<int>(ModSource::LAST_SOURCE)};
+    constexpr int kModTargets{static_cast<int>(ModTarget::LAST_TARGET)};
+
+    // Modulation of each target at full scale: semitones of pitch, amount of
+    // character around its middle, semitones of cutoff, octaves of damp and
+    // reverb feedback.
+    constexpr float kModDepths[kModTargets]{12.f, 0.5f, 36.f, 2.f, 0.3f};
+
+    // Routes each target to one source. The sources are bipolar, between -1
+    // and 1, and sampled once per audio block, the banks interpolate the
+    // targets across the next block.
+    class ModMatrix
+    {
+    public:
+        ModMatrix() {}
+        ~ModMatrix() {}
+
+        void SetRoute(ModTarget target, ModSource source)
+        {
+            routes_[static_cast<int>(target)] = source;
+        }
+
+        ModSource Route(ModTarget target) const
+        {
+            return routes_[static_cast<int>(target)];
+        }
+
+        void SetSource(ModSource source, float value)
+        {
+            if (ModSource::NONE == source)
+            {
+                return;
+            }
+            sources_[static_cast<int>(source)] = fclamp(value, -1.f, 1.f);
+        }
+
+        // The routed source times the depth of the target, 0 without a route.
+        float Value(ModTarget target) const
+        {
+            const int t{static_cast<int>(target)};
+
+            return sources_[static_cast<int>(routes_[t])] * kModDepths[t];
+        }
+
+    private:
+        ModSource routes_[kModTargets]{};
+        // The first one is ModSource::NONE, always 0.
+        float sources_[kModSources]{};
+    };
+
+    // Sets the targets of both banks, once per block before processing it.
+    // Without a route the character is left as the patches set it.
+    inline void ApplyModulation(const ModMatrix &matrix, GeneratorBank &generatorBank, EffectBank &effectBank)
+    {
+        generatorBank.SetPitchModulation(matrix.Value(ModTarget::PITCH));
+        if (ModSource::NONE != matrix.Route(ModTarget::CHARACTER))
+        {
+            generatorBank.SetCharacterModulation(0.5f + matrix.Value(ModTarget::CHARACTER));
+        }
+        effectBank.SetCutoffModulation(matrix.Value(ModTarget::CUTOFF));
+        effectBank.SetDampModulation(matrix.Value(ModTarget::DAMP));
+        effectBank.SetSizeModulation(matrix.Value(ModTarget::SIZE));
+    }
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "Utility/dsp.h"
+
+#include "commons.h"
+
+namespace orchard
+{
+    using namespace daisysp;
+
+    enum class Waveform
+    {
+        SINE,
+        // Variable saw, from a triangle to a ramp with a moving pulse width.
+        SAW,
+        // PolyBLEP pulse, and a PolyBLAMP triangle that rises for the duty
+        // cycle of the pulse.
+        PULSE,
+        TRIANGLE,
+    };
+
+    constexpr int kMaxVoices{8};
+
+    // Phases of the kernels, in 1 / kPhaseOne turns.
+    constexpr int32_t kPhaseOne{1 << 24};
+    constexpr float kPhaseScale{1.f / kPhaseOne};
+
+    // The pitched generators as one engine. Phase, increment and shape of all
+    // the voices are kept in arrays, one entry per voice. The frequency and
+    // the shape only change between blocks, so the phase of every sample of
+    // a block is known in advance: each voice is rendered with a loop over
+    // the samples of the block, branch free, which the compiler vectorizes
+    // on the host. The waveforms are those of the DaisySP Oscillator (sine),
+    // VariableSawOscillator and BlOsc (square) they replace. The triangle of
+    // BlOsc integrates its square, it is rendered from the phase instead, as
+    // the variable saw at shape 0 with its corners band limited.
+    class OscillatorBank
+    {
+    public:
+        OscillatorBank() {}
+        ~OscillatorBank() {}
+
+        void Init(float sampleRate)
+        {
+            sampleRate_ = sampleRate;
+            voices_ = 0;
+        }
+
+        // Returns the new voice, or -1 if there are already kMaxVoices.
+        int AddVoice(Waveform waveform)
+        {
+            if (voices_ >= kMaxVoices)
+            {
+                return -1;
+            }
+            const int voice{voices_++};
+            waveforms_[voice] = waveform;
+            phases_[voice] = 0;
+            SetFreq(voice, 220.f);
+            SetPw(voice, Waveform::SAW == waveform ? 0.f : 0.5f);
+            SetShape(voice, 1.f);
+
+            return voice;
+        }
+
+        // Up to half the sample rate, a quarter for the saw and the triangle.
+        void SetFreq(int voice, float freq)
+        {
+            const bool sloped{Waveform::SAW == waveforms_[voice] || Waveform::TRIANGLE == waveforms_[voice]};
+            const float increment{fclamp(freq / sampleRate_, 1e-6f, sloped ? 0.25f : 0.5f)};
+            dts_[voice] = increment;
+            increments_[voice] = static_cast<uint32_t>(increment * 4294967296.f);
+        }
+
+        // Pulse width as set on the DaisySP oscillators: between -1 and 1 for
+        // the saw, 1 minus the duty cycle for the pulse and the triangle.
+        void SetPw(int voice, float pw)
+        {
+            pws_[voice] = Waveform::SAW == waveforms_[voice] ? fclamp(pw, -1.f, 1.f) * 0.5f + 0.5f : 1.f - pw;
+        }
+
+        // Saw only, 0 is the triangle and 1 the ramp.
+        void SetShape(int voice, float shape)
+        {
+            shapes_[voice] = shape;
+        }
+
+        // Writes n samples of the voice, n must not exceed kMaxBlockSize.
+        void ProcessBlock(int voice, float *out, size_t n)
+        {
+            switch (waveforms_[voice])
+            {
+            case Waveform::SINE:
+                SineBlock(voice, out, n);
+                break;
+
+            case Waveform::SAW:
+                SawBlock(voice, out, n);
+                break;
+
+            case Waveform::PULSE:
+                PulseBlock(voice, out, n);
+                break;
+
+            case Waveform::TRIANGLE:
+                TriangleBlock(voice, out, n);
+                break;
+
+            default:
+                break;
+            }
+        }
+
+    private:
+        // Phases of the block, the first one offset by the given number of
+        // increments. The phases are fixed point turns, so the sum of the
+        // increments is exact and the phase of a sample doesn't depend on
+        // the block size.
+        inline void Phases(int voice, int32_t *phases, size_t n, uint32_t offset)
+        {
+            const uint32_t increment{increments_[voice]};
+            uint32_t phase{phases_[voice] + offset * increment};
+            for (size_t i = 0; i < n; i++)
+            {
+                phases[i] = static_cast<int32_t>(phase >> 8);
+                phase += increment;
+            }
+            phases_[voice] += increment * static_cast<uint32_t>(n);
+        }
+
+        // The first phase not below a fraction of a turn.
+        static inline int32_t ToPhase(float turns)
+        {
+            return static_cast<int32_t>(std::ceil(turns * kPhaseOne));
+        }
+
+        // 1 if x > 0, else 0, from the sign of -x. With the default
+        // -ftrapping-math gcc doesn't vectorize a loop that selects on a float
+        // comparison, the kernels compare the phases as integers and blend
+        // with these steps.
+        static inline float Step(int32_t x)
+        {
+            return static_cast<float>(static_cast<int32_t>((0u - static_cast<uint32_t>(x)) >> 31));
+        }
+
+        // sin(2 pi phase) for phase in [0, 1), folded to [-1/4, 1/4] of a
+        // turn and taken from its series, the error is below 1e-7.
+        static inline float Sine(float phase)
+        {
+            const float x{0.5f - phase};
+            const float ax{std::fabs(x)};
+            const float z{TWOPI_F * std::copysign(std::min(ax, 0.5f - ax), x)};
+            const float z2{z * z};
+
+            return z * (1.f + z2 * (-1.f / 6.f + z2 * (1.f / 120.f + z2 * (-1.f / 5040.f + z2 * (1.f / 362880.f + z2 * (-1.f / 39916800.f))))));
+        }
+
+        // 1 at phase 0 down to 0 an increment away on both sides, the
+        // increment is at most half a turn. The distance to phase 0 and the
+        // clamp are written with fabs, both exact on the fixed point phases:
+        // gcc moves the products of the callers into the arms of min and max,
+        // and then doesn't vectorize them.
+        static inline float Nearness(float t, float invDt)
+        {
+            const float x{1.f - (0.5f - std::fabs(t - 0.5f)) * invDt};
+
+            return 0.5f * (x + std::fabs(x));
+        }
+
+        // Correction of a step at phase 0, negative after it.
+        static inline float PolyBlep(float t, float invDt)
+        {
+            const float x{Nearness(t, invDt)};
+
+            return std::copysign(x * x, t - 0.5f);
+        }
+
+        // Correction of a corner at phase 0, six times the one of a slope
+        // that increases by one per sample.
+        static inline float PolyBlamp(float t, float invDt)
+        {
+            const float x{Nearness(t, invDt)};
+
+            return x * x * x;
+        }
+
+        // The rising part of the saw and the triangle, at most four times as
+        // steep as the ramp, or half a turn at high frequencies.
+        static inline float Slopes(float pw, float increment)
+        {
+            return fclamp(pw, std::min(4.f * increment, 0.5f), std::max(1.f - 4.f * increment, 0.5f));
+        }
+
+        void SineBlock(int voice, float *out, size_t n)
+        {
+            int32_t phases[kMaxBlockSize];
+            Phases(voice, phases, n, 0);
+            for (size_t i = 0; i < n; i++)
+            {
+                out[i] = Sine(phases[i] * kPhaseScale);
+            }
+        }
+
+        // The phase moves before each sample.
+        void SawBlock(int voice, float *out, size_t n)
+        {
+            int32_t phases[kMaxBlockSize];
+            Phases(voice, phases, n, 1);
+            const float increment{dts_[voice]};
+            const float pw{Slopes(pws_[voice], increment)};
+            const int32_t edge{ToPhase(pw)};
+            const float invPw{1.f / pw};
+            const float invRest{1.f / (1.f - pw)};
+            const float shape{shapes_[voice]};
+            for (size_t i = 0; i < n; i++)
+            {
+                const float phase{phases[i] * kPhaseScale};
+                const float rising{Step(edge - phases[i])};
+                const float falling{1.f - rising};
+                // phase / pw rising, (1 - phase) / (1 - pw) falling.
+                const float saw{phase * (rising * invPw - falling * invRest) + falling * invRest};
+                const float ramp{phase - rising};
+                out[i] = (1.f - shape) * (2.f * saw - 1.f) + shape * ramp;
+            }
+        }
+
+        void PulseBlock(int voice, float *out, size_t n)
+        {
+            int32_t phases[kMaxBlockSize];
+            Phases(voice, phases, n, 0);
+            const float invDt{1.f / dts_[voice]};
+            const int32_t edge{ToPhase(fclamp(pws_[voice], 0.05f, 0.95f))};
+            for (size_t i = 0; i < n; i++)
+            {
+                const int32_t phase{phases[i]};
+                const int32_t fall{(phase - edge) & (kPhaseOne - 1)};
+                out[i] = 2.f * Step(edge - phase) - 1.f + PolyBlep(phase * kPhaseScale, invDt) - PolyBlep(fall * kPhaseScale, invDt);
+            }
+        }
+
+        // Rises for the duty cycle of the pulse, from -1 at phase 0, and
+        // falls back. The phase moves before each sample, as for the saw.
+        void TriangleBlock(int voice, float *out, size_t n)
+        {
+            int32_t phases[kMaxBlockSize];
+            Phases(voice, phases, n, 1);
+            const float dt{dts_[voice]};
+            const float invDt{1.f / dt};
+            const float pw{Slopes(fclamp(pws_[voice], 0.05f, 0.95f), dt)};
+            const int32_t edge{ToPhase(pw)};
+            const float invPw{1.f / pw};
+            const float invRest{1.f / (1.f - pw)};
+            // The slope changes by 2 / pw + 2 / (1 - pw) per turn at the
+            // corners.
+            const float corner{(invPw + invRest) * dt * (1.f / 3.f)};
+            for (size_t i = 0; i < n; i++)
+            {
+                const float phase{phases[i] * kPhaseScale};
+                // The lower of phase / pw and (1 - phase) / (1 - pw).
+                const float up{phase * invPw};
+                const float down{(1.f - phase) * invRest};
+                const float triangle{0.5f * (up + down - std::fabs(up - down))};
+                const int32_t top{(phases[i] - edge) & (kPhaseOne - 1)};
+                out[i] = 2.f * triangle - 1.f + corner * (PolyBlamp(phase, invDt) - PolyBlamp(top * kPhaseScale, invDt));
+            }
+        }
+
+        float sampleRate_{48000.f};
+        int voices_{0};
+        Waveform waveforms_[kMaxVoices];
+        // Phase and increment in fixed point turns, the increment as a
+        // fraction of a turn as well.
+        alignas(16) uint32_t phases_[kMaxVoices];
+        alignas(16) uint32_t increments_[kMaxVoices];
+        alignas(16) float dts_[kMaxVoices];
+        alignas(16) float pws_[kMaxVoices];
+        alignas(16) float shapes_[kMaxVoices];
+    };
+}
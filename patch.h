@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+
+#include "generatorbank.h"
+#include "effectbank.h"
+
+namespace orchard
+{
+    // Single producer, single consumer handoff of one value between the main
+    // loop and the audio callback, without locks. The producer fills the slot
+    // returned by Acquire and publishes it, the consumer reads it with Peek and
+    // gives it back with Release. Acquire returns nullptr while the consumer
+    // still holds the previous value.
+    template <typename T>
+    class Mailbox
+    {
+    public:
+        Mailbox() {}
+        ~Mailbox() {}
+
+        // Producer side.
+        T *Acquire()
+        {
+            return full_.load(std::memory_order_acquire) ? nullptr : &value_;
+        }
+
+        void Publish()
+        {
+            full_.store(true, std::memory_order_release);
+        }
+
+        // Consumer side.
+        const T *Peek() const
+        {
+            return full_.load(std::memory_order_acquire) ? &value_ : nullptr;
+        }
+
+        void Release()
+        {
+            full_.store(false, std::memory_order_release);
+        }
+
+    private:
+        T value_;
+        std::atomic<bool> full_{false};
+    };
+
+    // A new patch for either bank or both.
+    struct Patch
+    {
+        bool hasGenerators;
+        GeneratorPatch generators;
+        bool hasEffects;
+        EffectPatch effects;
+    };
+
+    inline void ApplyPatch(const Patch &patch, GeneratorBank &generatorBank, EffectBank &effectBank)
+    {
+        if (patch.hasGenerators)
+        {
+            generatorBank.Apply(patch.generators);
+        }
+        if (patch.hasEffects)
+        {
+            effectBank.Apply(patch.effects);
+        }
+    }
+}
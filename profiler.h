@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#if !defined(__arm__)
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+namespace orchard
+{
+    // Stages can nest, Ring is part of Gen and everything is part of Block.
+    enum class Stage
+    {
+        GENERATORS,
+        RING,
+        FILTER,
+        SATURATOR,
+        RESONATOR,
+        DELAY,
+        REVERB,
+        OUTPUT,
+        BLOCK,
+        LAST_STAGE,
+    };
+    constexpr int kStages{static_cast<int>(Stage::LAST_STAGE)};
+    constexpr const char *kStageNames[kStages]{"Gen", "Ring", "Filter", "Sat", "Reso", "Delay", "Reverb", "Out", "Block"};
+
+    // Free running cycle counter: the DWT cycle counter on the Cortex-M7, the
+    // time stamp counter (or a nanoseconds clock) on the host.
+    struct CycleCounter
+    {
+        static void Init()
+        {
+#if defined(__arm__)
+            volatile uint32_t *demcr{reinterpret_cast<volatile uint32_t *>(0xE000EDFC)};
+            volatile uint32_t *dwtLar{reinterpret_cast<volatile uint32_t *>(0xE0001FB0)};
+            volatile uint32_t *dwtCtrl{reinterpret_cast<volatile uint32_t *>(0xE0001000)};
+            *demcr |= 1 << 24; // TRCENA
+            *dwtLar = 0xC5ACCE55;
+            *dwtCtrl |= 1; // CYCCNTENA
+#endif
+        }
+
+        static inline uint32_t Now()
+        {
+#if defined(__arm__)
+            return *reinterpret_cast<volatile uint32_t *>(0xE0001004);
+#elif defined(__x86_64__) || defined(__i386__)
+            return static_cast<uint32_t>(__rdtsc());
+#else
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return static_cast<uint32_t>(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+#endif
+        }
+
+#if !defined(__arm__)
+        // Counter ticks per second, measured against the monotonic clock.
+        static float Frequency()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            timespec start, now;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            uint64_t startTicks{__rdtsc()};
+            double elapsed;
+            do
+            {
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+            } while (elapsed < 0.05);
+
+            return static_cast<float>((__rdtsc() - startTicks) / elapsed);
+#else
+            return 1e9f;
+#endif
+        }
+#endif
+    };
+
+    struct StageStats
+    {
+        uint32_t min;
+        uint32_t mean;
+        uint32_t max;
+        uint32_t p99;
+        // Percentage of the blocks in which the stage was asleep.
+        int asleep;
+    };
+
+    // Keeps the cycles spent in each stage, and whether it was asleep, for the
+    // last kProfilerHistory blocks. The audio callback adds cycles and closes
+    // blocks, statistics are computed on demand outside of it.
+    constexpr int kProfilerHistory{256};
+
+    class Profiler
+    {
+    public:
+        Profiler() {}
+        ~Profiler() {}
+
+        void Init(float sampleRate, size_t blockSize, float cyclesPerSecond)
+        {
+            CycleCounter::Init();
+            budget_ = static_cast<uint32_t>(cyclesPerSecond * blockSize / sampleRate);
+        }
+
+        inline void Add(Stage stage, uint32_t cycles)
+        {
+            current_[static_cast<int>(stage)] += cycles;
+        }
+
+        // Marks a stage as sleeping, until the next call.
+        inline void SetAsleep(Stage stage, bool asleep)
+        {
+            asleep_[static_cast<int>(stage)] = asleep;
+        }
+
+        bool Asleep(Stage stage) const
+        {
+            return asleep_[static_cast<int>(stage)];
+        }
+
+        inline void EndBlock()
+        {
+            for (int i = 0; i < kStages; i++)
+            {
+                history_[i][position_] = current_[i];
+                asleepHistory_[i][position_] = asleep_[i];
+                current_[i] = 0;
+            }
+            position_ = (position_ + 1) % kProfilerHistory;
+            if (blocks_ < kProfilerHistory)
+            {
+                ++blocks_;
+            }
+        }
+
+        StageStats Stats(Stage stage) const
+        {
+            StageStats stats{0, 0, 0, 0, 0};
+            int n{blocks_};
+            if (n == 0)
+            {
+                return stats;
+            }
+
+            uint32_t cycles[kProfilerHistory];
+            std::copy(history_[static_cast<int>(stage)], history_[static_cast<int>(stage)] + n, cycles);
+            uint64_t sum{0};
+            int asleep{0};
+            for (int i = 0; i < n; i++)
+            {
+                sum += cycles[i];
+                asleep += asleepHistory_[static_cast<int>(stage)][i] ? 1 : 0;
+            }
+            std::sort(cycles, cycles + n);
+            stats.min = cycles[0];
+            stats.mean = static_cast<uint32_t>(sum / n);
+            stats.max = cycles[n - 1];
+            stats.p99 = cycles[(n - 1) * 99 / 100];
+            stats.asleep = 100 * asleep / n;
+
+            return stats;
+        }
+
+        // Cycles available for one block in real-time.
+        uint32_t Budget() const
+        {
+            return budget_;
+        }
+
+        // Percentage of the block budget used by the given cycles.
+        int Load(uint32_t cycles) const
+        {
+            return budget_ > 0 ? static_cast<int>(100ull * cycles / budget_) : 0;
+        }
+
+    private:
+        uint32_t current_[kStages]{};
+        uint32_t history_[kStages][kProfilerHistory]{};
+        bool asleep_[kStages]{};
+        bool asleepHistory_[kStages][kProfilerHistory]{};
+        int position_{0};
+        int blocks_{0};
+        uint32_t budget_{0};
+    };
+
+    Profiler profiler;
+
+    struct ProfileScope
+    {
+        ProfileScope(Stage stage) : stage_{stage}, start_{CycleCounter::Now()} {}
+        ~ProfileScope()
+        {
+            profiler.Add(stage_, CycleCounter::Now() - start_);
+        }
+
+        Stage stage_;
+        uint32_t start_;
+    };
+}
+
+// Instrumentation is opt-in, build with ORCHARD_PROFILE defined to enable it.
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#ifdef ORCHARD_PROFILE
+#define PROFILE_STAGE(stage) orchard::ProfileScope PROFILE_CONCAT(profileScope, __LINE__){stage}
+#define PROFILE_END_BLOCK() orchard::profiler.EndBlock()
+#define PROFILE_ASLEEP(stage, asleep) orchard::profiler.SetAsleep(stage, asleep)
+#else
+#define PROFILE_STAGE(stage)
+#define PROFILE_END_BLOCK()
+#define PROFILE_ASLEEP(stage, asleep)
+#endif
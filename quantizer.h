@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+
+#include "commons.h"
+#include "tables.h"
+
+namespace orchard
+{
+    constexpr Scale kDefaultScale{Scale::PHRYGIAN};
+
+    // Snaps pitches to the notes of a scale on a root, 0 is C. The nearest
+    // note of every midi note is a table, rebuilt from kScaleNotes only when
+    // the scale or the root changes, so quantizing a pitch costs a lookup.
+    class Quantizer
+    {
+    public:
+        Quantizer() {}
+        ~Quantizer() {}
+
+        void Init()
+        {
+            scale_ = kDefaultScale;
+            root_ = 0;
+            Build();
+        }
+
+        // Returns true if the table has been rebuilt.
+        bool SetScale(Scale scale)
+        {
+            if (scale == scale_ || scale >= Scale::LAST_SCALE)
+            {
+                return false;
+            }
+            scale_ = scale;
+            Build();
+
+            return true;
+        }
+
+        bool SetRoot(int root)
+        {
+            root = std::min(std::max(root, 0), 11);
+            if (root == root_)
+            {
+                return false;
+            }
+            root_ = root;
+            Build();
+
+            return true;
+        }
+
+        Scale GetScale() const
+        {
+            return scale_;
+        }
+
+        int Root() const
+        {
+            return root_;
+        }
+
+        // The nearest note of the scale to pitch.
+        inline int Note(float pitch) const
+        {
+            return notes_[Index(pitch)];
+        }
+
+        // Semitones of an interval of the scale, see scales in commons.h.
+        inline int Interval(int interval) const
+        {
+            return scales[static_cast<int>(scale_)][std::min(std::max(interval, 0), scaleIntervals - 1)];
+        }
+
+    private:
+        static inline int Index(float pitch)
+        {
+            return std::min(static_cast<int>(fclamp(pitch, 0.f, kMidiNotes - 1.f) + 0.5f), kMidiNotes - 1);
+        }
+
+        // kScaleNotes is rooted on C: a note is looked up root
+        // semitones down, an octave higher below the root, then moved back.
+        // Notes that land outside the midi range go to the lowest or the
+        // highest note of the scale inside it.
+        void Build()
+        {
+            const int offset{static_cast<int>(scale_) * kMidiNotes};
+            int lowest{kMidiNotes - 1};
+            int highest{0};
+            for (int note = 0; note < kMidiNotes; note++)
+            {
+                const int octave{note < root_ ? 12 : 0};
+                const int shifted{note - root_ + octave};
+                notes_[note] = kScaleNotes.values[offset + shifted] + root_ - octave;
+                if (notes_[note] >= 0 && notes_[note] < kMidiNotes)
+                {
+                    lowest = std::min(lowest, note);
+                    highest = std::max(highest, note);
+                }
+            }
+            std::fill(notes_, notes_ + lowest, notes_[lowest]);
+            std::fill(notes_ + highest + 1, notes_ + kMidiNotes, notes_[highest]);
+        }
+
+        Scale scale_{kDefaultScale};
+        int root_{0};
+        int notes_[kMidiNotes];
+    };
+}
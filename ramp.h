@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+namespace orchard
+{
+    enum class RampShape
+    {
+        LINEAR,
+        EXPONENTIAL,
+    };
+
+    // Moves a parameter towards its target in the given time, either per
+    // sample or n samples at once for parameters that are updated once per
+    // block. The first target is reached immediately, so that the first patch
+    // doesn't glide from the defaults. A finished ramp only costs the IsDone()
+    // check, callers don't process it.
+    class Ramp
+    {
+    public:
+        Ramp() {}
+        ~Ramp() {}
+
+        void Init(float sampleRate, float time, RampShape shape = RampShape::LINEAR)
+        {
+            sampleRate_ = sampleRate;
+            shape_ = shape;
+            primed_ = false;
+            done_ = true;
+            blockSize_ = 0;
+            SetTime(time);
+        }
+
+        // For exponential ramps the time is the time constant.
+        void SetTime(float time)
+        {
+            samples_ = time * sampleRate_;
+            coeff_ = samples_ > 1.f ? 1.f / samples_ : 1.f;
+            blockSize_ = 0;
+        }
+
+        void SetTarget(float target)
+        {
+            target_ = target;
+            if (!primed_)
+            {
+                Reset(target);
+
+                return;
+            }
+            step_ = samples_ > 1.f ? (target_ - value_) / samples_ : target_ - value_;
+            done_ = value_ == target_;
+        }
+
+        // Jumps to value, the next targets are glided to.
+        void Reset(float value)
+        {
+            primed_ = true;
+            value_ = value;
+            target_ = value;
+            done_ = true;
+        }
+
+        inline bool IsDone() const
+        {
+            return done_;
+        }
+
+        inline float Value() const
+        {
+            return value_;
+        }
+
+        inline float Target() const
+        {
+            return target_;
+        }
+
+        inline float Process()
+        {
+            return Process(1);
+        }
+
+        // Advances the ramp by n samples and returns the new value.
+        inline float Process(size_t n)
+        {
+            if (done_)
+            {
+                return value_;
+            }
+
+            if (RampShape::LINEAR == shape_)
+            {
+                value_ += step_ * n;
+                if ((step_ >= 0.f && value_ >= target_) || (step_ < 0.f && value_ <= target_))
+                {
+                    Finish();
+                }
+            }
+            else
+            {
+                if (n != blockSize_)
+                {
+                    // Coefficient of n one-pole steps.
+                    blockSize_ = n;
+                    blockCoeff_ = 1.f - std::pow(1.f - coeff_, static_cast<float>(n));
+                }
+                value_ += blockCoeff_ * (target_ - value_);
+                if (std::fabs(target_ - value_) < kThreshold * (1.f + std::fabs(target_)))
+                {
+                    Finish();
+                }
+            }
+
+            return value_;
+        }
+
+    private:
+        static constexpr float kThreshold{1e-4f};
+
+        void Finish()
+        {
+            value_ = target_;
+            done_ = true;
+        }
+
+        float sampleRate_{48000.f};
+        RampShape shape_{RampShape::LINEAR};
+        float samples_{0.f};
+        float coeff_{1.f};
+        float blockCoeff_{1.f};
+        size_t blockSize_{0};
+        float value_{0.f};
+        float target_{0.f};
+        float step_{0.f};
+        bool primed_{false};
+        bool done_{true};
+    };
+
+    // A value set once per block, reached linearly at the end of the next
+    // block. The block is processed in sub-blocks of kSubBlockSize samples,
+    // each one taking the value at its end, and only while the value moves.
+    class BlockRamp
+    {
+    public:
+        BlockRamp() {}
+        ~BlockRamp() {}
+
+        void SetTarget(float target)
+        {
+            target_ = target;
+        }
+
+        inline bool IsDone() const
+        {
+            return value_ == target_;
+        }
+
+        inline float Value() const
+        {
+            return value_;
+        }
+
+        // Value after offset samples of a block of n samples.
+        inline float At(size_t offset, size_t n) const
+        {
+            return value_ + (target_ - value_) * offset / n;
+        }
+
+        // Ends the block.
+        inline void Advance()
+        {
+            value_ = target_;
+        }
+
+    private:
+        float value_{0.f};
+        float target_{0.f};
+    };
+}
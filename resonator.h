@@ -1,107 +1,48 @@
 #pragma once
 
-#include "Filters/svf.h"
-#include "Utility/delayline.h"
+#include <algorithm>
+
 #include "Utility/dsp.h"
 
-using namespace daisysp;
+#include "commons.h"
+#include "delaylines.h"
+#include "denormals.h"
+#include "ramp.h"
+#include "tables.h"
 
-#define MAX_DELAY static_cast<size_t>(48000 * 1.f)
+using namespace daisysp;
 
 namespace orchard
 {
-    constexpr int kMaxPoles{5};
-
-    struct Pole
-    {
-        DelayLine<float, MAX_DELAY> *leftDel;
-        DelayLine<float, MAX_DELAY> *rightDel;
-        float currentLeftDelay;
-        float currentRightDelay;
-        float leftDelayTarget;
-        float rightDelayTarget;
-
-        Svf filt;
-
-        float sampleRate_{0.f};
-        float damp_{0.f};
-        float decay_{0.f};
-        float detune_{0.f};
-        float basePitch_{60.f};
-        float pitch_{0.f};
-
-        void Init(float sampleRate, DelayLine<float, MAX_DELAY> *lDel, DelayLine<float, MAX_DELAY> *rDel)
-        {
-            leftDel = lDel;
-            rightDel = rDel;
-            sampleRate_ = sampleRate;
-            filt.Init(sampleRate_);
-            filt.SetDrive(0.1f);
-        }
-
-        void SetFrequency()
-        {
-            filt.SetFreq(fclamp(mtof(pitch_) + damp_, 0.f, sampleRate_ / 3.f));
-        }
-
-        void SetDelayTimes()
-        {
-            leftDelayTarget = pow10f((pitch_ - detune_) / 20.0f);  // ms
-            leftDelayTarget *= sampleRate_ * 0.001f;              // ms to samples ?
-            rightDelayTarget = pow10f((pitch_ + detune_) / 20.0f); // ms
-            rightDelayTarget *= sampleRate_ * 0.001f;             // ms to samples ?
-        }
+    constexpr int kMaxPoles{16};
 
-        void SetDetune(float detune)
-        {
-            detune_ = detune;
-            SetDelayTimes();
-            SetFrequency();
-        }
+    // Limits of the pole parameters, the pole delay lines are sized for them
+    // and kMaxSampleRate.
+    constexpr float kMinPolePitch{0.f};
+    constexpr float kMaxPolePitch{127.f};
+    constexpr float kMaxPoleDetune{0.1f};
 
-        void SetDamp(float damp)
-        {
-            damp_ = damp;
-            SetFrequency();
-        }
-
-        void SetPitch(float pitch)
-        {
-            basePitch_ = pitch;
-            pitch_ = basePitch_;
-            pitch_ *= -0.5017f;
-            pitch_ += 17.667f;
-            SetDelayTimes();
-            SetFrequency();
-        }
-
-        float ProcessLeft(float in)
-        {
-            fonepole(currentLeftDelay, leftDelayTarget, .0002f);
-            leftDel->SetDelay(currentLeftDelay);
-
-            float leftW = leftDel->Read();
-            filt.Process(leftW);
-            leftW = filt.Low();
-            leftDel->Write((decay_ * leftW) + in);
-
-            return leftW;
-        }
-
-        float ProcessRight(float in)
-        {
-            fonepole(currentRightDelay, rightDelayTarget, .0002f);
-            rightDel->SetDelay(currentRightDelay);
+    // Delay of a pole in samples, see Resonator::SetPitch.
+    constexpr float PoleDelay(float pitch, float detune, float sampleRate)
+    {
+        return ConstPow10(((pitch * -0.5017f + 17.667f) + detune) / 20.f) * sampleRate * 0.001f;
+    }
 
-            float rightW = rightDel->Read();
-            filt.Process(rightW);
-            rightW = filt.Low();
-            rightDel->Write((decay_ * rightW) + in);
+    // The longest delay is reached with the lowest pitch and the largest
+    // detune, the interpolated read needs one more sample.
+    constexpr float kMaxPoleDelay{PoleDelay(kMinPolePitch, kMaxPoleDetune, kMaxSampleRate)};
+    constexpr size_t kPoleLineSize{NextPowerOfTwo(static_cast<size_t>(kMaxPoleDelay) + 2)};
+    static_assert(kMaxPoleDelay + 2 <= kPoleLineSize, "The pole delay lines are too short");
 
-            return rightW;
-        }
-    };
+    // The pole lines are short enough for the internal RAM.
+    using PoleLine = MaskedDelayLine<kPoleLineSize>;
 
+    // A bank of up to kMaxPoles poles, each one a stereo pair of delay lines
+    // with a low pass filter (the update of daisysp::Svf) in the feedback
+    // path. The state is kept as a structure of arrays with one lane per pole
+    // and channel (lane 2 * pole + channel), so that the per-sample loops run
+    // over contiguous lanes and the compiler can vectorize them on the host.
+    // On the M7 they are plain scalar loops.
     class Resonator
     {
 
@@ -112,66 +53,236 @@ namespace orchard
         void Init(float sampleRate)
         {
             sampleRate_ = sampleRate;
+            fcMax_ = sampleRate_ / 3.f;
+            damp_.Init(sampleRate_, 0.05f, RampShape::EXPONENTIAL);
+            decay_.Init(sampleRate_, 0.05f);
         }
-        void AddPole(DelayLine<float, MAX_DELAY> *left, DelayLine<float, MAX_DELAY> *right)
+        void AddPole(PoleLine *left, PoleLine *right)
         {
-            poles_[nPoles_].Init(sampleRate_, left, right);
-            nPoles_++;
+            if (nPoles_ >= kMaxPoles)
+            {
+                return;
+            }
+            const int pole{nPoles_++};
+            lines_[2 * pole] = left;
+            lines_[2 * pole + 1] = right;
+            pitches_[pole] = 0.f;
+            // The normalization is only computed when the number of poles
+            // changes.
+            gain_ = 1.f / nPoles_;
+            UpdateDelays(pole);
+            UpdateFilter(pole);
         }
+        // Damp and decay glide to the new value, see UpdateParameters.
         void SetDamp(float damp)
         {
-            for (int i = 0; i < nPoles_; i++)
+            damp_.SetTarget(damp);
+            if (damp_.IsDone())
             {
-                poles_[i].SetDamp(damp);
+                ApplyDamp();
             }
         }
+        // Scales the damp, for its modulation. Recomputes the filters at
+        // once.
+        void SetDampScale(float scale)
+        {
+            dampScale_ = scale;
+            ApplyDamp();
+        }
+
         void SetReso(float reso)
         {
+            reso_ = fclamp(reso, 0.f, 1.f);
+            drive_ = kDrive * reso_;
             for (int i = 0; i < nPoles_; i++)
             {
-                poles_[i].filt.SetRes(reso);
+                UpdateFilter(i);
             }
         }
         void SetDecay(float decay)
         {
-            for (int i = 0; i < nPoles_; i++)
-            {
-                poles_[i].decay_ = decay;
-            }
+            decay_.SetTarget(decay);
         }
         void SetDetune(float detune)
         {
+            detune_ = fclamp(detune, 0.f, kMaxPoleDetune);
             for (int i = 0; i < nPoles_; i++)
             {
-                poles_[i].SetDetune(detune);
+                UpdateDelays(i);
             }
         }
         void SetPitch(int pole, float pitch)
         {
-            poles_[pole].SetPitch(pitch);
+            pitches_[pole] = fclamp(pitch, kMinPolePitch, kMaxPolePitch) * -0.5017f + 17.667f;
+            UpdateDelays(pole);
+            UpdateFilter(pole);
+        }
+
+        // Samples taken by the poles to ring down below threshold. The loop
+        // gain is bounded by the decay times the resonance peak of the
+        // loop filters.
+        float Tail(float threshold) const
+        {
+            float longest{0.f};
+            float damp{2.f};
+            for (int l = 0; l < 2 * nPoles_; l++)
+            {
+                longest = std::max(longest, std::max(delays_[l], delayTargets_[l]));
+                damp = std::min(damp, damps_[l]);
+            }
+            const float decay{std::max(decay_.Value(), decay_.Target())};
+
+            return FeedbackTail(longest, damp > 0.f ? decay * std::max(1.f, 1.f / damp) : 1.f, threshold);
+        }
+
+        // Moves the parameters along as ProcessBlock would, for the blocks
+        // that are not processed. The delays jump to their targets.
+        void Idle(size_t n)
+        {
+            UpdateParameters(n);
+            std::copy(delayTargets_, delayTargets_ + 2 * nPoles_, delays_);
         }
 
         void Process(float &left, float &right)
         {
-            float leftW{0.f};
-            float rightW{0.f};
-            for (int i = 0; i < nPoles_; i++)
+            ProcessBlock(&left, &right, 1);
+        }
+
+        // Processes n samples in place.
+        void ProcessBlock(float *left, float *right, size_t n)
+        {
+            UpdateParameters(n);
+
+            const int lanes{2 * nPoles_};
+            const float decay{decay_.Value()};
+            for (size_t i = 0; i < n; i++)
             {
-                leftW += poles_[i].ProcessLeft(left) * (1.f / nPoles_);
-                rightW += poles_[i].ProcessRight(right) * (1.f / nPoles_);
+                const float in[2]{left[i], right[i]};
+
+                alignas(16) float w[2 * kMaxPoles];
+                for (int l = 0; l < lanes; l++)
+                {
+                    fonepole(delays_[l], delayTargets_[l], .0002f);
+                }
+                for (int l = 0; l < lanes; l++)
+                {
+                    w[l] = lines_[l]->Read(delays_[l]);
+                }
+                FilterLanes(w, lanes);
+                alignas(16) float feedback[2 * kMaxPoles];
+                for (int l = 0; l < lanes; l++)
+                {
+                    feedback[l] = FlushDenormal((decay * w[l]) + in[l & 1]);
+                }
+                for (int l = 0; l < lanes; l++)
+                {
+                    lines_[l]->Write(feedback[l]);
+                }
+
+                float sum[2]{};
+                for (int l = 0; l < lanes; l += 2)
+                {
+                    sum[0] += w[l] * gain_;
+                    sum[1] += w[l + 1] * gain_;
+                }
+                left[i] = sum[0];
+                right[i] = sum[1];
             }
-            left = leftW;
-            right = rightW;
         }
 
     private:
-        Pole poles_[kMaxPoles];
+        static constexpr float kDrive{0.01f};
+
+        // Replaces x with the low pass output of the filter of each lane, the
+        // filter runs twice per sample as daisysp::Svf does.
+        inline void FilterLanes(float *x, int lanes)
+        {
+            for (int l = 0; l < lanes; l++)
+            {
+                float low{low_[l]};
+                float band{band_[l]};
+                float sum{0.f};
+                for (int pass = 0; pass < 2; pass++)
+                {
+                    const float notch{x[l] - damps_[l] * band};
+                    low += freqs_[l] * band;
+                    const float high{notch - low};
+                    band += freqs_[l] * high - drive_ * band * band * band;
+                    sum += low;
+                }
+                low_[l] = low;
+                band_[l] = band;
+                x[l] = 0.5f * sum;
+            }
+        }
+
+        void UpdateDelays(int pole)
+        {
+            float left{Pow10((pitches_[pole] - detune_) / 20.0f)}; // ms
+            left *= sampleRate_ * 0.001f;                            // ms to samples ?
+            float right{Pow10((pitches_[pole] + detune_) / 20.0f)}; // ms
+            right *= sampleRate_ * 0.001f;                            // ms to samples ?
+            delayTargets_[2 * pole] = left;
+            delayTargets_[2 * pole + 1] = right;
+        }
+
+        // Filter coefficients of both lanes of the pole, as daisysp::Svf
+        // computes them.
+        void UpdateFilter(int pole)
+        {
+            const float fc{fclamp(fclamp(Mtof(pitches_[pole]) + damp_.Value() * dampScale_, 0.f, fcMax_), 1.0e-6f, fcMax_)};
+            const float freq{2.f * sinf(PI_F * std::min(0.25f, fc / (sampleRate_ * 2.f)))};
+            const float damp{std::min(2.f * (1.f - powf(reso_, 0.25f)), std::min(2.f, 2.f / freq - freq * 0.5f))};
+            for (int c = 0; c < 2; c++)
+            {
+                freqs_[2 * pole + c] = freq;
+                damps_[2 * pole + c] = damp;
+            }
+        }
+
+        // Moves damp and decay once per block while they are ramping.
+        void UpdateParameters(size_t n)
+        {
+            if (!damp_.IsDone())
+            {
+                damp_.Process(n);
+                ApplyDamp();
+            }
+            if (!decay_.IsDone())
+            {
+                decay_.Process(n);
+            }
+        }
+
+        void ApplyDamp()
+        {
+            for (int i = 0; i < nPoles_; i++)
+            {
+                UpdateFilter(i);
+            }
+        }
+
+        // Per lane state.
+        PoleLine *lines_[2 * kMaxPoles];
+        alignas(16) float delays_[2 * kMaxPoles]{};
+        alignas(16) float delayTargets_[2 * kMaxPoles]{};
+        alignas(16) float freqs_[2 * kMaxPoles]{};
+        alignas(16) float damps_[2 * kMaxPoles]{};
+        alignas(16) float low_[2 * kMaxPoles]{};
+        alignas(16) float band_[2 * kMaxPoles]{};
+
+        // Per pole pitch, as mapped by SetPitch.
+        float pitches_[kMaxPoles]{};
+
         float sampleRate_;
-        float damp_{0.f};   // 0.0 and sample_rate / 3
-        float reso_{0.f};   // 0.0 : 0.4
-        float decay_{0.f};  // 0.0 : ?
+        float fcMax_;
+        Ramp damp_;         // 0.0 and sample_rate / 3
+        float dampScale_{1.f};
+        float reso_{0.5f};  // 0.0 : 0.4
+        float drive_{kDrive * 0.5f};
+        Ramp decay_;        // 0.0 : ?
         float detune_{0.f}; // 0.0 : 0.07
-        float pitches_[kMaxPoles];
+        float gain_{1.f};
         int nPoles_{0};
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#include "Utility/dsp.h"
+
+#include "commons.h"
+
+namespace orchard
+{
+    using namespace daisysp;
+
+    // Non zero taps of the halfband FIR filters (Kaiser windowed sinc, the
+    // center tap is 0.5). The first stage runs at 2x, 31 taps, about 70 dB of
+    // rejection from 0.35 fs, the second stage only has to reject the images
+    // above 0.4 fs at 4x, 15 taps.
+    constexpr int kHalfbandLongTaps{16};
+    constexpr float kHalfbandLong[kHalfbandLongTaps]{
+        -1.258541307e-04f, 1.064443005e-03f, -3.772257231e-03f, 9.803523146e-03f,
+        -2.159067148e-02f, 4.398647160e-02f, -9.308523723e-02f, 3.137195823e-01f,
+        3.137195823e-01f, -9.308523723e-02f, 4.398647160e-02f, -2.159067148e-02f,
+        9.803523146e-03f, -3.772257231e-03f, 1.064443005e-03f, -1.258541307e-04f};
+    constexpr int kHalfbandShortTaps{8};
+    constexpr float kHalfbandShort[kHalfbandShortTaps]{
+        -6.756808724e-04f, 1.270625275e-02f, -6.267968645e-02f, 3.006491146e-01f,
+        3.006491146e-01f, -6.267968645e-02f, 1.270625275e-02f, -6.756808724e-04f};
+
+    // Polyphase halfband interpolator and decimator by 2. Only the non zero
+    // taps are computed: one phase is a plain delay, the other a short FIR
+    // run over the whole block, tap by tap, so that the inner loops are over
+    // contiguous samples.
+    template <int taps>
+    class Halfband
+    {
+    public:
+        Halfband() {}
+        ~Halfband() {}
+
+        void Init(const float *coeffs)
+        {
+            coeffs_ = coeffs;
+            std::fill(upHistory_, upHistory_ + kHistory, 0.f);
+            std::fill(downEven_, downEven_ + kHistory, 0.f);
+            std::fill(downOdd_, downOdd_ + kHistory, 0.f);
+        }
+
+        // Writes 2 * n samples to out, n must not exceed kMaxFilterBlock.
+        void Upsample(const float *in, float *out, size_t n)
+        {
+            float x[kHistory + kMaxFilterBlock];
+            std::copy(upHistory_, upHistory_ + kHistory, x);
+            std::copy(in, in + n, x + kHistory);
+
+            float even[kMaxFilterBlock]{};
+            for (int k = 0; k < taps; k++)
+            {
+                const float c{2.f * coeffs_[k]};
+                const float *src{x + kHistory - k};
+                for (size_t m = 0; m < n; m++)
+                {
+                    even[m] += c * src[m];
+                }
+            }
+            for (size_t m = 0; m < n; m++)
+            {
+                out[2 * m] = even[m];
+                out[2 * m + 1] = x[kHistory + m - kUpDelay];
+            }
+
+            std::copy(x + n, x + n + kHistory, upHistory_);
+        }
+
+        // Reads 2 * n samples from in and writes n samples to out.
+        void Downsample(const float *in, float *out, size_t n)
+        {
+            float even[kHistory + kMaxFilterBlock];
+            float odd[kHistory + kMaxFilterBlock];
+            std::copy(downEven_, downEven_ + kHistory, even);
+            std::copy(downOdd_, downOdd_ + kHistory, odd);
+            for (size_t m = 0; m < n; m++)
+            {
+                even[kHistory + m] = in[2 * m];
+                odd[kHistory + m] = in[2 * m + 1];
+            }
+
+            for (size_t m = 0; m < n; m++)
+            {
+                out[m] = 0.5f * odd[kHistory + m - kDownDelay];
+            }
+            for (int k = 0; k < taps; k++)
+            {
+                const float c{coeffs_[k]};
+                const float *src{even + kHistory - k};
+                for (size_t m = 0; m < n; m++)
+                {
+                    out[m] += c * src[m];
+                }
+            }
+
+            std::copy(even + n, even + n + kHistory, downEven_);
+            std::copy(odd + n, odd + n + kHistory, downOdd_);
+        }
+
+    private:
+        // Longest block at the input of a halfband, the 4x path runs the
+        // second stage on 2x blocks.
+        static constexpr size_t kMaxFilterBlock{2 * kMaxBlockSize};
+        static constexpr size_t kHistory{taps};
+        // The center tap, relative to the non zero taps, at the input rate.
+        static constexpr size_t kUpDelay{taps / 2 - 1};
+        static constexpr size_t kDownDelay{taps / 2};
+
+        const float *coeffs_{nullptr};
+        float upHistory_[kHistory];
+        float downEven_[kHistory];
+        float downOdd_[kHistory];
+    };
+
+    enum class SaturatorCurve
+    {
+        SOFT,
+        CUBIC,
+        HARD,
+        LAST_CURVE,
+    };
+
+    // Waveshaper with 1x, 2x or 4x oversampling, driven by a gain between 1
+    // and kMaxSaturatorGain.
+    constexpr float kMaxSaturatorGain{10.f};
+
+    class Saturator
+    {
+    public:
+        Saturator() {}
+        ~Saturator() {}
+
+        void Init(float sampleRate)
+        {
+            sampleRate_ = sampleRate;
+            for (int c = 0; c < 2; c++)
+            {
+                first_[c].Init(kHalfbandLong);
+                second_[c].Init(kHalfbandShort);
+                std::fill(dry_[c], dry_[c] + kMaxLatency, 0.f);
+                align_[c] = 0.f;
+            }
+            SetDrive(0.f);
+        }
+
+        // 1, 2 or 4.
+        void SetOversampling(int factor)
+        {
+            oversampling_ = factor >= 4 ? 4 : (factor >= 2 ? 2 : 1);
+        }
+
+        int Oversampling() const
+        {
+            return oversampling_;
+        }
+
+        // Delay of the output, in samples, from the linear phase halfbands.
+        size_t Latency() const
+        {
+            return 1 == oversampling_ ? 0 : (2 == oversampling_ ? kLatency2x : kLatency4x);
+        }
+
+        void SetCurve(SaturatorCurve curve)
+        {
+            curve_ = curve;
+        }
+
+        // Between 0 and 1, the output is compensated by the square root of
+        // the gain.
+        void SetDrive(float drive)
+        {
+            gain_ = 1.f + fclamp(drive, 0.f, 1.f) * (kMaxSaturatorGain - 1.f);
+            makeup_ = 1.f / std::sqrt(gain_);
+        }
+
+        void ProcessBlock(float *left, float *right, size_t n)
+        {
+            ProcessChannel(0, left, n);
+            ProcessChannel(1, right, n);
+        }
+
+        // Delays the dry signal by Latency(), so that it lines up with the
+        // output when they are mixed.
+        void DelayDry(float *left, float *right, size_t n)
+        {
+            DelayChannel(dry_[0], left, n);
+            DelayChannel(dry_[1], right, n);
+        }
+
+    private:
+        // Each halfband delays by taps - 1 samples at its rate, once up and
+        // once down. The 4x path is delayed by one more sample at 2x so that
+        // its latency is whole samples.
+        static constexpr size_t kLatency2x{kHalfbandLongTaps - 1};
+        static constexpr size_t kLatency4x{kLatency2x + kHalfbandShortTaps / 2};
+        static constexpr size_t kMaxLatency{kLatency4x};
+
+        void DelayChannel(float *history, float *x, size_t n)
+        {
+            float buffer[kMaxLatency + kMaxBlockSize];
+            std::copy(history, history + kMaxLatency, buffer);
+            std::copy(x, x + n, buffer + kMaxLatency);
+            const float *delayed{buffer + kMaxLatency - Latency()};
+            std::copy(delayed, delayed + n, x);
+            std::copy(buffer + n, buffer + n + kMaxLatency, history);
+        }
+
+        void ProcessChannel(int c, float *x, size_t n)
+        {
+            if (1 == oversampling_)
+            {
+                Shape(x, n);
+
+                return;
+            }
+
+            float x2[2 * kMaxBlockSize];
+            first_[c].Upsample(x, x2, n);
+            if (2 == oversampling_)
+            {
+                Shape(x2, 2 * n);
+            }
+            else
+            {
+                float x4[4 * kMaxBlockSize];
+                second_[c].Upsample(x2, x4, 2 * n);
+                Shape(x4, 4 * n);
+                second_[c].Downsample(x4, x2, 2 * n);
+                const float last{x2[2 * n - 1]};
+                std::copy_backward(x2, x2 + 2 * n - 1, x2 + 2 * n);
+                x2[0] = align_[c];
+                align_[c] = last;
+            }
+            first_[c].Downsample(x2, x, n);
+        }
+
+        void Shape(float *x, size_t n)
+        {
+            switch (curve_)
+            {
+            case SaturatorCurve::CUBIC:
+                ShapeBlock(x, n, [](float v) {
+                    v = fclamp(v, -1.f, 1.f);
+                    return 1.5f * (v - v * v * v / 3.f);
+                });
+                break;
+
+            case SaturatorCurve::HARD:
+                ShapeBlock(x, n, [](float v) { return fclamp(v, -1.f, 1.f); });
+                break;
+
+            default:
+                ShapeBlock(x, n, [](float v) { return SoftClip(v); });
+                break;
+            }
+        }
+
+        template <typename Curve>
+        inline void ShapeBlock(float *x, size_t n, Curve curve)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                x[i] = curve(x[i] * gain_) * makeup_;
+            }
+        }
+
+        Halfband<kHalfbandLongTaps> first_[2];
+        Halfband<kHalfbandShortTaps> second_[2];
+        float dry_[2][kMaxLatency];
+        // Last 2x sample of the 4x path, delayed to the next block.
+        float align_[2];
+        float sampleRate_{48000.f};
+        SaturatorCurve curve_{SaturatorCurve::SOFT};
+        int oversampling_{2};
+        float gain_{1.f};
+        float makeup_{1.f};
+    };
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "commons.h"
+
+namespace orchard
+{
+    // Compile time versions of the functions below, as series in double
+    // precision. They are only meant to fill the tables and to size buffers.
+    constexpr double ConstExp(double x)
+    {
+        // exp(x / 2^8)^(2^8), the series converges fast on the reduced
+        // argument.
+        double y{x / 256.};
+        double term{1.};
+        double sum{1.};
+        for (int i = 1; i < 20; i++)
+        {
+            term *= y / i;
+            sum += term;
+        }
+        for (int i = 0; i < 8; i++)
+        {
+            sum *= sum;
+        }
+
+        return sum;
+    }
+
+    constexpr double kLn2{0.693147180559945309};
+    constexpr double kLn10{2.302585092994045684};
+
+    constexpr float ConstPow10(float x)
+    {
+        return static_cast<float>(ConstExp(x * kLn10));
+    }
+
+    constexpr double kHalfPi{1.570796326794896619};
+
+    // Taylor series, for x between 0 and pi / 2.
+    constexpr double ConstSin(double x)
+    {
+        double term{x};
+        double sum{x};
+        for (int i = 1; i < 12; i++)
+        {
+            term *= -x * x / ((2 * i) * (2 * i + 1));
+            sum += term;
+        }
+
+        return sum;
+    }
+
+    template <typename T, size_t size>
+    struct Table
+    {
+        T values[size];
+    };
+
+    // 2^x for x between 0 and 1, the last entry closes the octave so that
+    // the interpolation needs no wrap.
+    constexpr int kExp2TableSize{256};
+
+    constexpr Table<float, kExp2TableSize + 1> MakeExp2Table()
+    {
+        Table<float, kExp2TableSize + 1> table{};
+        for (int i = 0; i <= kExp2TableSize; i++)
+        {
+            table.values[i] = static_cast<float>(ConstExp(static_cast<double>(i) / kExp2TableSize * kLn2));
+        }
+
+        return table;
+    }
+
+    constexpr Table<float, kExp2TableSize + 1> kExp2Table{MakeExp2Table()};
+
+    // Quarter sine for the constant power pan law, linearly interpolated by
+    // PanGains in generatorbank.h.
+    constexpr int kPanTableSize{64};
+
+    constexpr Table<float, kPanTableSize + 1> MakePanTable()
+    {
+        Table<float, kPanTableSize + 1> table{};
+        for (int i = 0; i <= kPanTableSize; i++)
+        {
+            table.values[i] = static_cast<float>(ConstSin(kHalfPi * i / kPanTableSize));
+        }
+
+        return table;
+    }
+
+    constexpr Table<float, kPanTableSize + 1> kPanTable{MakePanTable()};
+
+    // 2^x, interpolated from kExp2Table, the integer part of x goes to the
+    // exponent. The relative error is below 1e-6 for x between -126 and 127,
+    // values outside are clamped.
+    inline float Exp2(float x)
+    {
+        x = fclamp(x, -126.f, 127.f);
+        int octave{static_cast<int>(x)};
+        octave -= x < octave ? 1 : 0;
+        const float position{(x - octave) * kExp2TableSize};
+        const int index{std::min(static_cast<int>(position), kExp2TableSize - 1)};
+        const float frac{position - index};
+        const float a{kExp2Table.values[index]};
+        const float b{kExp2Table.values[index + 1]};
+
+        const uint32_t bits{static_cast<uint32_t>(octave + 127) << 23};
+        float scale;
+        std::memcpy(&scale, &bits, sizeof(scale));
+
+        return (a + (b - a) * frac) * scale;
+    }
+
+    // Replaces daisysp::mtof, fractional midi notes to Hz.
+    inline float Mtof(float midi)
+    {
+        return 440.f * Exp2((midi - 69.f) * (1.f / 12.f));
+    }
+
+    // Replaces pow10f, e.g. dB / 20 to gain.
+    inline float Pow10(float x)
+    {
+        return Exp2(x * static_cast<float>(kLn10 / kLn2));
+    }
+
+    // The midi notes 0-127 quantized to each scale, rooted on C. A note
+    // halfway between two degrees goes to the lower one.
+    constexpr int kMidiNotes{128};
+
+    constexpr int QuantizeNote(Scale scale, int note)
+    {
+        // The second half of each scale row is an octave, from 0 to 12.
+        const int *degrees{scales[static_cast<int>(scale)] + scaleIntervals / 2};
+        const int octave{note / 12};
+        const int semitone{note % 12};
+        int best{0};
+        for (int i = 1; i <= scaleIntervals / 2; i++)
+        {
+            const int distance{semitone - degrees[i]};
+            const int bestDistance{semitone - degrees[best]};
+            if ((distance < 0 ? -distance : distance) < (bestDistance < 0 ? -bestDistance : bestDistance))
+            {
+                best = i;
+            }
+        }
+
+        return std::min(octave * 12 + degrees[best], kMidiNotes - 1);
+    }
+
+    constexpr int kScales{static_cast<int>(Scale::LAST_SCALE)};
+
+    constexpr Table<uint8_t, kScales * kMidiNotes> MakeScaleNoteTable()
+    {
+        Table<uint8_t, kScales * kMidiNotes> table{};
+        for (int s = 0; s < kScales; s++)
+        {
+            for (int note = 0; note < kMidiNotes; note++)
+            {
+                table.values[s * kMidiNotes + note] = static_cast<uint8_t>(QuantizeNote(static_cast<Scale>(s), note));
+            }
+        }
+
+        return table;
+    }
+
+    constexpr Table<uint8_t, kScales * kMidiNotes> kScaleNotes{MakeScaleNoteTable()};
+
+    // The nearest midi note of the scale to pitch.
+    inline int QuantizedNote(Scale scale, float pitch)
+    {
+        const int note{static_cast<int>(fclamp(pitch, 0.f, kMidiNotes - 1.f) + 0.5f)};
+
+        return kScaleNotes.values[static_cast<int>(scale) * kMidiNotes + std::min(note, kMidiNotes - 1)];
+    }
+}